@@ -1,5 +1,5 @@
 // =================== Evaluation Weights ===================
-#define VALUE_KING 9999     // arbitrarily large to prioritize king safety
+#define VALUE_KING 100      // only ranks the king for exchanges; mates are scored by the search
 #define VALUE_QUEEN 9
 #define VALUE_ROOK 5
 #define VALUE_BISHOP 3      // I'm not sure whether or not to keep the values for bihop and knight
@@ -13,8 +13,58 @@
 #define PENALTY_ISOLATED_PAWN 20
 #define BONUS_BISHOP_PAIR 50
 #define BONUS_CONNECTED_ROOKS 25
-#define MAX_DEPTH 4
-#define INFINITY 10000
+#define ENDGAME_MATERIAL 12 // at most this many non-king pieces left counts as an endgame
+#define SCORE_INFINITY 10000   // search score bound (math.h already defines INFINITY)
+#define SCORE_MATE 9900        // mated at ply p scores -(SCORE_MATE - p), so shorter mates score higher
+#define SCORE_MATE_BOUND (SCORE_MATE - MAX_PLY) // scores beyond this are mates, evaluations stay below it
+
+// =================== Search Limits ===================
+#define MAX_DEPTH 64            // iterative deepening stops here even with time left
+#define MAX_PLY 128             // deepest ply the PV table can hold
+#define DEFAULT_MOVE_TIME 1000  // ms per AI move when no other limit is given
+#define NODE_CHECK_INTERVAL 2048 // nodes between clock checks (power of two)
+#define ASPIRATION_WINDOW 50    // initial half-width around the previous iteration's score
+#define CLOCK_MOVES_TO_GO 30    // with a game clock, assume this many moves still to play
+
+// =================== Draw Rules ===================
+#define FIFTY_MOVE_PLIES 100    // reversible plies (no capture or pawn move) before the game is drawn
+#define UNDO_STACK_SIZE 512     // the fifty-move window plus the deepest search path, with room to spare
+
+// =================== Search Pruning ===================
+#define NULL_MOVE_MIN_DEPTH 3   // shallower nodes gain too little from a null move
+#define NULL_MOVE_REDUCTION 2   // R, plus one more ply for every 6 plies of depth
+#define NULL_MOVE_VERIFICATION true // in endgames, confirm null-move cutoffs with a real reduced search
+#define LMR_MIN_DEPTH 3         // late move reductions start at this depth
+#define LMR_MIN_MOVE_INDEX 3    // the first moves in the ordered list are never reduced
+#define LMR_BASE 0.75           // reduction = LMR_BASE + log(depth) * log(moveIndex) / LMR_DIVISOR
+#define LMR_DIVISOR 2.25
+#define LMR_HISTORY_DIVISOR 8192 // each this much combined history takes one ply off (or adds one to) the reduction
+#define REVERSE_FUTILITY_DEPTH 3 // frontier pruning (reverse futility, futility, razoring) only this close to the horizon
+#define REVERSE_FUTILITY_MARGIN 80 // per ply: a static eval this far above beta is returned as the score
+#define FUTILITY_DEPTH 3
+#define FUTILITY_MARGIN 80      // per ply: quiet moves are skipped when the static eval plus this cannot reach alpha
+#define RAZOR_DEPTH 3
+#define RAZOR_MARGIN 200        // per ply: this far below alpha the node is handed to quiescence
+#define LATE_MOVE_DEPTH 3       // move-count pruning: at this depth or less, quiet moves past
+#define LATE_MOVE_BASE 3        // index LATE_MOVE_BASE + depth * depth are no longer searched
+#define HISTORY_PRUNING_DEPTH 2
+#define HISTORY_PRUNING_MARGIN 32 // per ply: quiet moves with history below minus this are skipped (bonuses are depth squared)
+#define SINGULAR_MIN_DEPTH 6    // singular extensions: the hash move is tested for being the only good move
+#define SINGULAR_DEPTH_MARGIN 3 // when its entry was searched at least depth - this
+#define SINGULAR_MARGIN 2       // per ply: every other move must stay this far below the hash score
+#define SHOW_SEARCH_STATS false // print node and pruning counters after each AI move
+#define QS_MAX_PLY 32           // quiescence stops following capture chains this many plies past the horizon
+#define DELTA_PIECE_WEIGHT 100  // a captured piece can move the evaluation by up to value * this (hanging term)
+#define DELTA_MARGIN 200        // positional swing allowed on top of the victim when delta pruning
+
+// =================== Move Ordering ===================
+#define ORDER_HASH_MOVE 1000000
+#define ORDER_CAPTURE 200000    // captures and promotions sit above every quiet move
+#define ORDER_KILLER_1 100000
+#define ORDER_KILLER_2 90000
+#define ORDER_COUNTER_MOVE 80000 // quiet moves without a killer or counter slot are ranked by history below these
+#define ORDER_LOSING_CAPTURE -100000 // captures that lose material by SEE go after every quiet move
+#define HISTORY_MAX 16384       // history scores saturate towards +/- this
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,22 +72,93 @@
 #include <string.h>
 #include <strings.h>
 #include <stdbool.h>
-
-const char pieces[] =
+#include <time.h>
+#include <math.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// Build with -DDEBUG_ALLOCATIONS to count every heap allocation made by this file;
+// -bench then fails if a search made any
+#ifdef DEBUG_ALLOCATIONS
+static long long allocationCount = 0;
+
+static inline void *countedMalloc(size_t size) { allocationCount++; return malloc(size); }
+static inline void *countedCalloc(size_t count, size_t size) { allocationCount++; return calloc(count, size); }
+static inline void *countedRealloc(void *block, size_t size) { allocationCount++; return realloc(block, size); }
+static inline void *countedAlignedAlloc(size_t alignment, size_t size) { allocationCount++; return aligned_alloc(alignment, size); }
+
+#define malloc(size) countedMalloc(size)
+#define calloc(count, size) countedCalloc(count, size)
+#define realloc(block, size) countedRealloc(block, size)
+#define aligned_alloc(alignment, size) countedAlignedAlloc(alignment, size)
+#endif
+
+// =================== Bitboards ===================
+// Squares are numbered y * 8 + x, so bit 0 is a8 and bit 63 is h1 (same orientation as board[y][x])
+typedef unsigned long long U64;
+
+#define WHITE 0
+#define BLACK 1
+#define PAWN 0
+#define KNIGHT 1
+#define BISHOP 2
+#define ROOK 3
+#define QUEEN 4
+#define KING 5
+
+// A piece code is its type plus one with the colour in bit 3, so both come out with a shift and a
+// mask and every per-piece property is a 16-entry table. Characters only appear for input and printing
+#define EMPTY 0
+#define MAKE_PIECE(color, type) (((color) << 3) | ((type) + 1))
+#define WHITE_PAWN MAKE_PIECE(WHITE, PAWN)
+#define WHITE_KNIGHT MAKE_PIECE(WHITE, KNIGHT)
+#define WHITE_BISHOP MAKE_PIECE(WHITE, BISHOP)
+#define WHITE_ROOK MAKE_PIECE(WHITE, ROOK)
+#define WHITE_QUEEN MAKE_PIECE(WHITE, QUEEN)
+#define WHITE_KING MAKE_PIECE(WHITE, KING)
+#define BLACK_PAWN MAKE_PIECE(BLACK, PAWN)
+#define BLACK_KNIGHT MAKE_PIECE(BLACK, KNIGHT)
+#define BLACK_BISHOP MAKE_PIECE(BLACK, BISHOP)
+#define BLACK_ROOK MAKE_PIECE(BLACK, ROOK)
+#define BLACK_QUEEN MAKE_PIECE(BLACK, QUEEN)
+#define BLACK_KING MAKE_PIECE(BLACK, KING)
+
+#define SQUARE(x, y) ((y) * 8 + (x))
+#define SQUARE_BIT(sq) (1ULL << (sq))
+#define FILE_A_BB 0x0101010101010101ULL
+#define FILE_H_BB 0x8080808080808080ULL
+#define RANK_BB(y) (0xFFULL << ((y) * 8))
+
+// MOVE keeps the y * 10 + x coordinates used for input and the opening book
+#define SQUARE_TO_COORD(sq) (((sq) / 8) * 10 + (sq) % 8)
+#define COORD_TO_SQUARE(coord) SQUARE((coord) % 10, (coord) / 10)
+
+// =================== Move Generation ===================
+#define MAX_MOVES 256       // more than the 218 legal moves any position can have
+#define GEN_ALL 0
+#define GEN_CAPTURES 1      // captures, capture-promotions and en passant
+#define GEN_QUIETS 2        // everything else, including quiet promotions and castling
+#define GEN_TACTICAL 3      // GEN_CAPTURES plus quiet queen promotions, for quiescence
+#define PERFT_MAX_DEPTH 6   // deepest -perft run that has reference counts for every position
+
+// =================== Transposition Table ===================
+#define TT_SIZE_MB 16       // default size, "-hash <MB>" on the command line overrides it
+#define TT_BUCKET_ENTRIES 4 // 4 x 16-byte entries fill one 64-byte cache line
+#define TT_EXACT 1
+#define TT_LOWER 2          // the score is at least this much (failed high)
+#define TT_UPPER 3          // the score is at most this much (failed low)
+#define TT_AGE_BITS 6
+#define NO_MOVE 0           // packed move meaning "none stored"
+
+const unsigned char pieces[] =
 {
-    'r', 'n', 'b', 'q', 'k', 'b', 'n', 'r', // I'm setting the knights as n because of the king being k
-    'p', 'p', 'p', 'p', 'p', 'p', 'p', 'p',
-    'P', 'P', 'P', 'P', 'P', 'P', 'P', 'P',
-    'R', 'N', 'B', 'Q', 'K', 'B', 'N', 'R'
+    BLACK_ROOK, BLACK_KNIGHT, BLACK_BISHOP, BLACK_QUEEN, BLACK_KING, BLACK_BISHOP, BLACK_KNIGHT, BLACK_ROOK,
+    BLACK_PAWN, BLACK_PAWN, BLACK_PAWN, BLACK_PAWN, BLACK_PAWN, BLACK_PAWN, BLACK_PAWN, BLACK_PAWN,
+    WHITE_PAWN, WHITE_PAWN, WHITE_PAWN, WHITE_PAWN, WHITE_PAWN, WHITE_PAWN, WHITE_PAWN, WHITE_PAWN,
+    WHITE_ROOK, WHITE_KNIGHT, WHITE_BISHOP, WHITE_QUEEN, WHITE_KING, WHITE_BISHOP, WHITE_KNIGHT, WHITE_ROOK
 };
 
-typedef struct
-{
-    bool live;
-    char piece;
-    
-} piece;
-
 typedef struct 
 {
     int x;
@@ -48,23 +169,46 @@ typedef struct _move
 {
     int from;
     int to;
-    char movedPiece;
-    char capturedPiece;
-    char promotionPiece;  // For pawn promotion
+    unsigned char movedPiece;
+    unsigned char capturedPiece;   // EMPTY for none
+    unsigned char promotionPiece;  // For pawn promotion, EMPTY otherwise
     bool isCastling;      // For castling moves
     bool isEnPassant;     // For en passant captures
     int score;
 } MOVE;
 
+// State a move destroys and undoMove cannot work out from the move itself, saved by makeMove
+typedef struct
+{
+    U64 key;               // also what repetitionCount() compares against
+    int halfmoveClock;
+    int enPassantFile;
+    int enPassantRank;
+    unsigned char capturedPiece; // the pawn for en passant, EMPTY for none
+    bool whiteCanCastleKingside;
+    bool whiteCanCastleQueenside;
+    bool blackCanCastleKingside;
+    bool blackCanCastleQueenside;
+    bool whiteCastled;
+    bool blackCastled;
+} UNDOSTATE;
+
+// Undo records of the game and of the search path, one per move still in the fifty-move window.
+// Copies of a position share one and each writes above its own historyCount
+typedef struct
+{
+    UNDOSTATE states[UNDO_STACK_SIZE];
+} GAMEHISTORY;
+
+// The position alone, kept small and cache-line aligned so copy-make can copy it every ply
 typedef struct _board
 {
-    char *moveLog[1000];
-    int moveCount;
-    piece board[8][8];
+    _Alignas(64) U64 pieceBB[2][6]; // [color][PAWN..KING]
+    U64 colorBB[2];        // all pieces of one color
+    U64 occupied;          // colorBB[WHITE] | colorBB[BLACK]
+    U64 attacks[2];        // squares attacked by each color, filled by updateAttackMap
     location whiteKing;
     location blackKing;
-    bool whiteAttacks[8][8];
-    bool blackAttacks[8][8];
     bool whiteCanCastleKingside;
     bool whiteCanCastleQueenside;
     bool blackCanCastleKingside;
@@ -73,13 +217,90 @@ typedef struct _board
     bool blackCastled;
     int enPassantFile;     // -1 if no en passant possible, 0-7 for file
     int enPassantRank;     // rank of the en passant target square
+    int sideToMove;        // WHITE or BLACK, flipped by makeMove/undoMove
+    U64 key;               // Zobrist key of everything above that defines the position
+    unsigned char board[8][8]; // piece codes, kept in sync with the bitboards for piece-at-square lookups
+    GAMEHISTORY *history;
+    int historyCount;
+    int halfmoveClock;     // plies since the last capture or pawn move
+    int moveCount;
 } BOARD;
 
+typedef struct
+{
+    U64 mask;       // relevant blockers (board edges excluded)
+    U64 magic;
+    U64 *attacks;   // this square's slice of rookTable/bishopTable
+    int shift;
+} MAGIC;
+
+// Per-node limits on where the side to move may go, computed once before generating
+typedef struct
+{
+    int kingSq;
+    int checkerCount;
+    U64 checkMask;      // squares that capture or block the checker (everything when not in check)
+    U64 pinned;         // own pieces that may only move along the line to their king
+} MOVEMASKS;
+
+typedef struct
+{
+    U64 key;
+    int score;
+    unsigned short move;    // best or refuting move, packed by packMove()
+    signed char depth;      // 0 for entries stored by quiescence
+    unsigned char boundAge; // TT_EXACT/LOWER/UPPER in the low 2 bits, search generation above
+} TTENTRY;
+
+typedef struct
+{
+    TTENTRY entries[TT_BUCKET_ENTRIES];
+} TTBUCKET;
+
+// How often each frontier pruning fired during the current search
+typedef struct
+{
+    long long reverseFutility;
+    long long futility;
+    long long razoring;
+    long long lateMove;
+    long long history;
+} PRUNESTATS;
+
+// Per-ply search state, indexed by the ply of the node that owns it
+typedef struct
+{
+    bool nullMove;          // this node is currently searching a null move
+    bool skipNullMove;      // set while verifying a null-move cutoff at this ply
+    unsigned short killers[2]; // quiet moves that caused a beta cutoff at this ply, newest first
+    unsigned short excludedMove; // skipped by the singular-extension search running at this ply
+    int movedPiece;         // pieceIndex() of the move being searched from this ply, -1 for none or a null move
+    int toSquare;           // and its destination square
+#ifdef COPY_MAKE
+    BOARD position;         // copy-make only: this ply's position, copied in by its parent
+#endif
+} SEARCHSTACK;
+
+// Any combination may be set; whichever runs out first ends the search (0 means unlimited)
+typedef struct
+{
+    int depth;              // deepest iteration to finish
+    long long nodes;        // node budget
+    int moveTime;           // fixed milliseconds per move
+    int timeLeft;           // AI clock in milliseconds, spent over the rest of the game
+    int increment;          // milliseconds added to the AI clock after each move
+} SEARCHLIMITS;
+
 BOARD *boardSetUp(void);
+bool loadFen(BOARD *chessBoard, const char *fen);
 void printBoard(BOARD *chessBoard);
 bool playPiece(int coordStart, int coordDestination, BOARD *chessBoard);
 void startGame();
 void ai_playPiece(int *AI_SCORE, BOARD *chessBoard);
+MOVE searchBestMove(BOARD *chessBoard, MOVE moves[], int moveCount, SEARCHLIMITS *limits, int *bestScoreOut);
+int runBench(int depth);
+unsigned long long perft(BOARD *chessBoard, int depth);
+int runPerft(int depth);
 int gameCheck(BOARD *chessBoard);
 bool moveChecker(int coordStart, int coordDestination, BOARD *chessBoard);
 bool basicMoveChecker(int coordStart, int coordDestination, BOARD *chessBoard);
@@ -89,13 +310,18 @@ bool isCastle(int coordStart, int coordDestination, BOARD *chessBoard);
 bool checkEmpty(int x, int y, BOARD *chessBoard);
 bool moveLeavesKingInCheck(BOARD *chessBoard, int color);
 int evaluateBoard(BOARD *chessBoard);
-int minimax(BOARD *chessBoard, int depth, int alpha, int beta, bool maximizingPlayer);
-int quiescence(BOARD *chessBoard, int alpha, int beta, bool maximizingPlayer);
+int minimax(BOARD *chessBoard, int depth, int ply, int alpha, int beta);
+int quiescence(BOARD *chessBoard, int depth, int ply, int alpha, int beta);
 void generateMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite);
 bool makeMove(BOARD *chessBoard, MOVE move);
+int repetitionCount(BOARD *chessBoard);
+bool isSearchRepetition(BOARD *chessBoard, int ply);
+void trimHistory(BOARD *chessBoard);
 void undoMove(BOARD *chessBoard, MOVE move);
-BOARD* copyBoard(BOARD *original);
-void freeBoard(BOARD *board);
+void makeNullMove(BOARD *chessBoard);
+void undoNullMove(BOARD *chessBoard);
+int countMaterial(BOARD *chessBoard);
+void initReductions(void);
 bool isInCheck(BOARD *chessBoard, bool isWhite);
 bool hasLegalMoves(BOARD *chessBoard, bool isWhite);
 MOVE getOpeningMove(BOARD *chessBoard);
@@ -103,45 +329,492 @@ bool canCastle(BOARD *chessBoard, bool isWhite, bool kingside);
 void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite);
 void generateEnPassantMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite);
 void generatePromotionMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, int from, int to);
+void generateLegalMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, int genType);
+bool isLegalMove(BOARD *chessBoard, MOVE move);
+bool givesCheck(BOARD *chessBoard, MOVE move);
 bool isPinnedPiece(BOARD *chessBoard, int piecePos, bool isWhite);
 bool isSquareAttacked(BOARD *chessBoard, int x, int y, bool byWhite);
-int getPieceValue(char piece);
-bool isPieceHanging(BOARD *chessBoard, int x, int y);
-int evaluateCaptures(BOARD *chessBoard, MOVE move);
-void orderMoves(BOARD *chessBoard, MOVE moves[], int moveCount);
-int countAttackers(BOARD *chessBoard, int x, int y, bool isWhite);
+int getPieceValue(int piece);
+int staticExchange(BOARD *chessBoard, MOVE move);
+int evaluateCaptures(MOVE move);
+void orderMoves(BOARD *chessBoard, MOVE moves[], int moveCount, unsigned short hashMove, SEARCHSTACK *stack);
 static void sanityValidateBoard(BOARD *b, const char *phase);
+bool ttInit(int megabytes);
+void ttClear(void);
+void ttNewSearch(void);
+TTENTRY *ttProbe(U64 key);
+void ttStore(U64 key, int depth, int score, int bound, unsigned short move);
+unsigned short packMove(MOVE move);
+void startSearch(SEARCHLIMITS *limits);
+void checkSearchLimits(void);
+void initBitboards(void);
+int pieceColor(int piece);
+int pieceType(int piece);
+int pieceIndex(int piece);
+int pieceFromChar(char c);
+void setPiece(BOARD *chessBoard, int x, int y, int piece);
+void clearSquare(BOARD *chessBoard, int x, int y);
+bool isSquareAttackedBy(BOARD *chessBoard, int sq, int byColor);
+U64 attackersTo(BOARD *chessBoard, int sq, int byColor, U64 occupied);
+void initZobrist(void);
+U64 computeKey(BOARD *chessBoard);
+static void initMagics(MAGIC magics[64], U64 *table, const int directions[4][2], const U64 magicNumbers[64]);
+
+// Precomputed lookup tables, filled once by initBitboards()
+U64 knightAttacks[64];
+U64 kingAttacks[64];
+U64 pawnAttacks[2][64];
+U64 adjacentFilesBB[8];
+U64 passedPawnMask[2][64];  // squares in front of a pawn (own file and both neighbours)
+U64 betweenBB[64][64];      // squares strictly between two squares on a shared rank, file or diagonal
+U64 lineBB[64][64];         // the whole rank, file or diagonal through two squares
+
+// Zobrist keys, filled once by initZobrist()
+U64 zobristPiece[2][6][64];
+U64 zobristCastling[16];    // indexed by castlingIndex()
+U64 zobristEnPassant[8];    // by file
+U64 zobristBlackToMove;
+
+// Transposition table, allocated by ttInit() and kept for the whole game
+TTBUCKET *ttTable = NULL;
+U64 ttBucketCount = 0;          // always a power of two
+unsigned char ttGeneration = 0; // bumped once per AI move so stale entries get replaced first
+
+// Search control; aiLimits comes from the command line, the rest is reset by startSearch()
+SEARCHLIMITS aiLimits = {MAX_DEPTH, 0, DEFAULT_MOVE_TIME, 0, 0};
+long long searchStartTime;
+long long searchSoftLimit;      // no new iteration is started after this
+long long searchHardLimit;      // the running iteration is abandoned after this
+long long searchNodes;
+long long searchNodeLimit;
+int searchCompletedDepth;       // depth of the last iteration searchBestMove() finished
+PRUNESTATS pruneStats;
+bool stopSearch;
+bool searchCanStop;             // false until the first iteration has produced a move
+
+// Triangular PV table: row ply holds the best line found from that ply on
+MOVE pvTable[MAX_PLY][MAX_PLY];
+int pvLength[MAX_PLY];
+MOVE previousPv[MAX_PLY];       // last completed iteration's line, searched first by the next one
+int previousPvLength;
+bool followPv;
+SEARCHSTACK searchStackEntries[MAX_PLY + 2];
+SEARCHSTACK *const searchStack = searchStackEntries + 2;   // searchStack[-1] and [-2] are empty sentinels for the root
+int lmrReductions[MAX_DEPTH][MAX_MOVES];   // plies taken off a late quiet move, by depth and move index
+int historyTable[2][64][64];    // butterfly history: [colour][from][to], rewarded on quiet beta cutoffs
+unsigned short counterMoves[12][64];    // quiet reply that refuted the opponent's [piece][to] last time
+int continuationHistory[2][12][64][12][64]; // [plies back - 1][earlier piece][earlier to][piece][to]
+
+// Sliding piece attacks: one table slice per square, indexed by the blockers on its rays
+MAGIC rookMagics[64];
+MAGIC bishopMagics[64];
+U64 rookTable[102400];
+U64 bishopTable[5248];
+
+const int pieceTypeValues[6] = {VALUE_PAWN, VALUE_KNIGHT, VALUE_BISHOP, VALUE_ROOK, VALUE_QUEEN, VALUE_KING};
+
+// Indexed by piece code; the unused codes (EMPTY, 7, 8, 15) have no value and no index
+const int pieceValues[16] = {0, VALUE_PAWN, VALUE_KNIGHT, VALUE_BISHOP, VALUE_ROOK, VALUE_QUEEN, VALUE_KING, 0,
+                             0, VALUE_PAWN, VALUE_KNIGHT, VALUE_BISHOP, VALUE_ROOK, VALUE_QUEEN, VALUE_KING, 0};
+const int pieceIndices[16] = {-1, 0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1};
+const char pieceChars[] = " PNBRQK  pnbrqk ";
+
+const int rookDirections[4][2] = {{1,0},{-1,0},{0,1},{0,-1}};
+const int bishopDirections[4][2] = {{1,1},{1,-1},{-1,1},{-1,-1}};
+
+// Multipliers that hash every blocker subset of a square's mask into its slice without a
+// destructive collision (found offline with a sparse random search, unused when PEXT is available)
+const U64 rookMagicNumbers[64] = {
+    0x1080004008801020ULL, 0x0840092002C03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+    0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+    0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000A001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+    0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021D00100ULL,
+    0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000A0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+    0x0442000A00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040A00128541ULL,
+    0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xC100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+    0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000A0020ULL,
+    0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040A00300ULL, 0x0801100280080480ULL,
+    0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+    0x0000209300488001ULL, 0x04C1002414824001ULL, 0x020020000B001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084C0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL
+};
+
+const U64 bishopMagicNumbers[64] = {
+    0xA010041108003100ULL, 0x006082020A002900ULL, 0x6810010619200000ULL, 0x08281A0520000408ULL,
+    0x0001104001000400ULL, 0x0018901008048400ULL, 0x00040A0210245280ULL, 0x000200210808A402ULL,
+    0x9140048410821200ULL, 0x0800091010820041ULL, 0x20504804832202C0ULL, 0x0100091401081000ULL,
+    0x8021011140000012ULL, 0x0810020804450400ULL, 0x208B0542109008A2ULL, 0x0080084A08040204ULL,
+    0x0040E2A80811244CULL, 0x2505022008008108ULL, 0x0430220100420040ULL, 0x010A040420220040ULL,
+    0x1105000290400000ULL, 0x0093001200822120ULL, 0x4000A62048043004ULL, 0x280120048A015004ULL,
+    0x006090002A020814ULL, 0x44042000240800D0ULL, 0x01102800040A4400ULL, 0x1004080080220040ULL,
+    0x0001001011004024ULL, 0x0010044000805040ULL, 0x0914041200820100ULL, 0x0004821012821480ULL,
+    0x0024040500C05021ULL, 0x0088611002080200ULL, 0x0116080A00040020ULL, 0x4000020080080080ULL,
+    0x2450450140840040ULL, 0x0000880201484100ULL, 0x0222020404020092ULL, 0x8081110600002E00ULL,
+    0x2842101105000801ULL, 0x1100809008001025ULL, 0x00020202221C0400ULL, 0x0422014022009020ULL,
+    0x0210046102100C00ULL, 0xC004008082029102ULL, 0x00AA461801101200ULL, 0x0404080080201108ULL,
+    0x020542108C205002ULL, 0x0410544804100100ULL, 0x0040910841100000ULL, 0x0400200042021100ULL,
+    0x00004204850400C0ULL, 0x0200100410A42102ULL, 0x1040020801210102ULL, 0x0805040410420000ULL,
+    0x2884804130100200ULL, 0x800C262201242000ULL, 0x1058000194108800ULL, 0x0014221054420204ULL,
+    0x0104000012A02200ULL, 0x0200881003300100ULL, 0x0140400202840100ULL, 0x0402020801010201ULL
+};
+
+static inline int popCount(U64 bb)
+{
+    return __builtin_popcountll(bb);
+}
+
+// Returns the index of the lowest set bit and clears it
+static inline int popLsb(U64 *bb)
+{
+    int sq = __builtin_ctzll(*bb);
+    *bb &= *bb - 1;
+    return sq;
+}
 
-int main(void)
+// Uses PEXT when the target has BMI2, otherwise the multiply-and-shift magic hash
+static inline unsigned magicIndex(const MAGIC *magic, U64 occupied)
 {
+#ifdef __BMI2__
+    return (unsigned)_pext_u64(occupied, magic->mask);
+#else
+    return (unsigned)(((occupied & magic->mask) * magic->magic) >> magic->shift);
+#endif
+}
+
+static inline U64 rookAttacks(int sq, U64 occupied)
+{
+    return rookMagics[sq].attacks[magicIndex(&rookMagics[sq], occupied)];
+}
+
+static inline U64 bishopAttacks(int sq, U64 occupied)
+{
+    return bishopMagics[sq].attacks[magicIndex(&bishopMagics[sq], occupied)];
+}
+
+// Packs the four castling rights into 0..15
+static inline int castlingIndex(BOARD *chessBoard)
+{
+    return chessBoard->whiteCanCastleKingside | (chessBoard->whiteCanCastleQueenside << 1) |
+           (chessBoard->blackCanCastleKingside << 2) | (chessBoard->blackCanCastleQueenside << 3);
+}
+
+int main(int argc, char *argv[])
+{
+    int hashMegabytes = TT_SIZE_MB;
+    int benchDepth = 0, perftDepth = 0;
+    bool moveTimeGiven = false, otherLimitGiven = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-hash") == 0) {
+            hashMegabytes = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-movetime") == 0) {
+            aiLimits.moveTime = atoi(argv[i + 1]);
+            moveTimeGiven = true;
+        } else if (strcmp(argv[i], "-depth") == 0) {
+            aiLimits.depth = atoi(argv[i + 1]);
+            otherLimitGiven = true;
+        } else if (strcmp(argv[i], "-nodes") == 0) {
+            aiLimits.nodes = atoll(argv[i + 1]);
+            otherLimitGiven = true;
+        } else if (strcmp(argv[i], "-time") == 0) {
+            aiLimits.timeLeft = atoi(argv[i + 1]);
+            otherLimitGiven = true;
+        } else if (strcmp(argv[i], "-inc") == 0) {
+            aiLimits.increment = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-bench") == 0) {
+            benchDepth = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-perft") == 0) {
+            perftDepth = atoi(argv[i + 1]);
+        }
+    }
+    
+    // An explicit depth, node or clock limit replaces the default move time
+    if (otherLimitGiven && !moveTimeGiven) aiLimits.moveTime = 0;
+    if (aiLimits.depth <= 0 || aiLimits.depth > MAX_DEPTH) aiLimits.depth = MAX_DEPTH;
+    
+    initBitboards();
+    initZobrist();
+    initReductions();
+    if (!ttInit(hashMegabytes)) {
+        printf("Could not allocate a %d MB hash table\n", hashMegabytes);
+        return 1;
+    }
+    if (benchDepth > 0) return runBench(benchDepth);
+    if (perftDepth > 0) return runPerft(perftDepth);
     startGame();
     return 0;
 }
 
+void initBitboards(void)
+{
+    int knightMoves[8][2] = {{-2,-1},{-2,1},{-1,-2},{-1,2},{1,-2},{1,2},{2,-1},{2,1}};
+
+    for (int x = 0; x < 8; x++) {
+        adjacentFilesBB[x] = 0;
+        if (x > 0) adjacentFilesBB[x] |= FILE_A_BB << (x - 1);
+        if (x < 7) adjacentFilesBB[x] |= FILE_A_BB << (x + 1);
+    }
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            int sq = SQUARE(x, y);
+
+            knightAttacks[sq] = 0;
+            for (int i = 0; i < 8; i++) {
+                int ny = y + knightMoves[i][0], nx = x + knightMoves[i][1];
+                if (ny >= 0 && ny < 8 && nx >= 0 && nx < 8) knightAttacks[sq] |= SQUARE_BIT(SQUARE(nx, ny));
+            }
+
+            kingAttacks[sq] = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int ny = y + dy, nx = x + dx;
+                    if ((dy || dx) && ny >= 0 && ny < 8 && nx >= 0 && nx < 8) kingAttacks[sq] |= SQUARE_BIT(SQUARE(nx, ny));
+                }
+            }
+
+            // White pawns attack towards y - 1, black pawns towards y + 1
+            pawnAttacks[WHITE][sq] = pawnAttacks[BLACK][sq] = 0;
+            for (int dx = -1; dx <= 1; dx += 2) {
+                if (x + dx < 0 || x + dx > 7) continue;
+                if (y > 0) pawnAttacks[WHITE][sq] |= SQUARE_BIT(SQUARE(x + dx, y - 1));
+                if (y < 7) pawnAttacks[BLACK][sq] |= SQUARE_BIT(SQUARE(x + dx, y + 1));
+            }
+
+            U64 files = (FILE_A_BB << x) | adjacentFilesBB[x];
+            passedPawnMask[WHITE][sq] = passedPawnMask[BLACK][sq] = 0;
+            for (int py = 0; py < 8; py++) {
+                if (py < y) passedPawnMask[WHITE][sq] |= files & RANK_BB(py);
+                if (py > y) passedPawnMask[BLACK][sq] |= files & RANK_BB(py);
+            }
+        }
+    }
+
+    initMagics(rookMagics, rookTable, rookDirections, rookMagicNumbers);
+    initMagics(bishopMagics, bishopTable, bishopDirections, bishopMagicNumbers);
+
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            U64 ends = SQUARE_BIT(a) | SQUARE_BIT(b);
+            betweenBB[a][b] = lineBB[a][b] = 0;
+            if (a == b) continue;
+
+            if (rookAttacks(a, 0) & SQUARE_BIT(b)) {
+                betweenBB[a][b] = rookAttacks(a, SQUARE_BIT(b)) & rookAttacks(b, SQUARE_BIT(a));
+                lineBB[a][b] = (rookAttacks(a, 0) & rookAttacks(b, 0)) | ends;
+            } else if (bishopAttacks(a, 0) & SQUARE_BIT(b)) {
+                betweenBB[a][b] = bishopAttacks(a, SQUARE_BIT(b)) & bishopAttacks(b, SQUARE_BIT(a));
+                lineBB[a][b] = (bishopAttacks(a, 0) & bishopAttacks(b, 0)) | ends;
+            }
+        }
+    }
+}
+
+// xorshift64*: plenty for hash keys and reproducible from a fixed seed
+static U64 randomU64(U64 *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Fixed seed so keys (and anything stored under them) are the same on every run
+void initZobrist(void)
+{
+    U64 seed = 0x9E3779B97F4A7C15ULL;
+    
+    for (int color = 0; color < 2; color++) {
+        for (int type = 0; type < 6; type++) {
+            for (int sq = 0; sq < 64; sq++) zobristPiece[color][type][sq] = randomU64(&seed);
+        }
+    }
+    for (int i = 0; i < 16; i++) zobristCastling[i] = randomU64(&seed);
+    for (int i = 0; i < 8; i++) zobristEnPassant[i] = randomU64(&seed);
+    zobristBlackToMove = randomU64(&seed);
+}
+
+// Builds the key from scratch; the incremental updates must always agree with it
+U64 computeKey(BOARD *chessBoard)
+{
+    U64 key = 0;
+    U64 pieces = chessBoard->occupied;
+    
+    while (pieces) {
+        int sq = popLsb(&pieces);
+        int piece = chessBoard->board[sq / 8][sq % 8];
+        key ^= zobristPiece[pieceColor(piece)][pieceType(piece)][sq];
+    }
+    key ^= zobristCastling[castlingIndex(chessBoard)];
+    if (chessBoard->enPassantFile != -1) key ^= zobristEnPassant[chessBoard->enPassantFile];
+    if (chessBoard->sideToMove == BLACK) key ^= zobristBlackToMove;
+    
+    return key;
+}
+
+int pieceColor(int piece)
+{
+    return piece >> 3;
+}
+
+// 0-5 for white PAWN..KING, 6-11 for black
+int pieceIndex(int piece)
+{
+    return pieceIndices[piece];
+}
+
+int pieceType(int piece)
+{
+    return (piece & 7) - 1;
+}
+
+// The piece code for a FEN letter, EMPTY for anything else
+int pieceFromChar(char c)
+{
+    if (c == ' ' || c == '\0') return EMPTY;
+    const char *found = strchr(pieceChars, c);
+    return found ? (int)(found - pieceChars) : EMPTY;
+}
+
+// Places a piece on an empty square, keeping the mailbox and the bitboards in sync
+void setPiece(BOARD *chessBoard, int x, int y, int piece)
+{
+    U64 bit = SQUARE_BIT(SQUARE(x, y));
+    int color = pieceColor(piece);
+
+    chessBoard->board[y][x] = piece;
+    chessBoard->pieceBB[color][pieceType(piece)] |= bit;
+    chessBoard->colorBB[color] |= bit;
+    chessBoard->occupied |= bit;
+    chessBoard->key ^= zobristPiece[color][pieceType(piece)][SQUARE(x, y)];
+}
+
+// Removes whatever stands on the square (no-op on an empty square)
+void clearSquare(BOARD *chessBoard, int x, int y)
+{
+    int piece = chessBoard->board[y][x];
+    if (piece == EMPTY) return;
+
+    U64 bit = SQUARE_BIT(SQUARE(x, y));
+    int color = pieceColor(piece);
+
+    chessBoard->board[y][x] = EMPTY;
+    chessBoard->pieceBB[color][pieceType(piece)] &= ~bit;
+    chessBoard->colorBB[color] &= ~bit;
+    chessBoard->occupied &= ~bit;
+    chessBoard->key ^= zobristPiece[color][pieceType(piece)][SQUARE(x, y)];
+}
+
+// Walks one ray per direction until the first blocker (blocker square included)
+static U64 slidingAttacks(int sq, U64 occupied, const int directions[4][2])
+{
+    U64 attacks = 0;
+    int x = sq % 8, y = sq / 8;
+
+    for (int d = 0; d < 4; d++) {
+        int nx = x + directions[d][0], ny = y + directions[d][1];
+        while (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
+            U64 bit = SQUARE_BIT(SQUARE(nx, ny));
+            attacks |= bit;
+            if (occupied & bit) break;
+            nx += directions[d][0];
+            ny += directions[d][1];
+        }
+    }
+    return attacks;
+}
+
+// Relevant blockers for a slider: every ray square except the last one before the edge
+static U64 slidingMask(int sq, const int directions[4][2])
+{
+    U64 mask = 0;
+    int x = sq % 8, y = sq / 8;
+
+    for (int d = 0; d < 4; d++) {
+        int nx = x + directions[d][0], ny = y + directions[d][1];
+        while (nx + directions[d][0] >= 0 && nx + directions[d][0] < 8 &&
+               ny + directions[d][1] >= 0 && ny + directions[d][1] < 8) {
+            mask |= SQUARE_BIT(SQUARE(nx, ny));
+            nx += directions[d][0];
+            ny += directions[d][1];
+        }
+    }
+    return mask;
+}
+
+static void initMagics(MAGIC magics[64], U64 *table, const int directions[4][2], const U64 magicNumbers[64])
+{
+    for (int sq = 0; sq < 64; sq++) {
+        MAGIC *m = &magics[sq];
+        m->mask = slidingMask(sq, directions);
+        m->magic = magicNumbers[sq];
+        m->shift = 64 - popCount(m->mask);
+        m->attacks = table;
+
+        // Store the real attack set of every blocker subset (Carry-Rippler enumeration of the mask)
+        U64 subset = 0;
+        do {
+            m->attacks[magicIndex(m, subset)] = slidingAttacks(sq, subset, directions);
+            table++;
+            subset = (subset - m->mask) & m->mask;
+        } while (subset);
+    }
+}
+
+// Whether any piece of byColor attacks sq, computed from the bitboards rather than the attack maps
+bool isSquareAttackedBy(BOARD *chessBoard, int sq, int byColor)
+{
+    U64 *enemy = chessBoard->pieceBB[byColor];
+
+    return (pawnAttacks[byColor ^ 1][sq] & enemy[PAWN]) ||
+           (knightAttacks[sq] & enemy[KNIGHT]) ||
+           (kingAttacks[sq] & enemy[KING]) ||
+           (bishopAttacks(sq, chessBoard->occupied) & (enemy[BISHOP] | enemy[QUEEN])) ||
+           (rookAttacks(sq, chessBoard->occupied) & (enemy[ROOK] | enemy[QUEEN]));
+}
+
+// All pieces of one colour attacking a square, with sliders seen through the given occupancy
+U64 attackersTo(BOARD *chessBoard, int sq, int byColor, U64 occupied)
+{
+    U64 *enemy = chessBoard->pieceBB[byColor];
+
+    return (pawnAttacks[byColor ^ 1][sq] & enemy[PAWN]) |
+           (knightAttacks[sq] & enemy[KNIGHT]) |
+           (kingAttacks[sq] & enemy[KING]) |
+           (bishopAttacks(sq, occupied) & (enemy[BISHOP] | enemy[QUEEN])) |
+           (rookAttacks(sq, occupied) & (enemy[ROOK] | enemy[QUEEN]));
+}
+
 BOARD *boardSetUp(void)
 {
-    BOARD *n = malloc(sizeof(BOARD));
+    BOARD *n = aligned_alloc(64, sizeof(BOARD));
+    n->history = malloc(sizeof(GAMEHISTORY));
+    memset(n->pieceBB, 0, sizeof(n->pieceBB));
+    memset(n->colorBB, 0, sizeof(n->colorBB));
+    memset(n->attacks, 0, sizeof(n->attacks));
+    n->occupied = 0;
+    n->key = 0;
 
     for (int i = 0, p = 0; i < 8; i++)
     {
         for (int k = 0; k < 8; k++)
         {
+            n->board[i][k] = EMPTY;
             if (i == 0 || i == 1 || i == 6 || i == 7)
             {
-                n->board[i][k].live = true;
-                n->board[i][k].piece = pieces[p];
+                setPiece(n, k, i, pieces[p]);
                 p++;
             }
-            else
-            {
-                n->board[i][k].piece = ' ';
-                n->board[i][k].live = false;
-            }
         }
     }
     n->blackKing.x = 4, n->blackKing.y = 0;
     n->whiteKing.x = 4, n->whiteKing.y = 7;
     n->moveCount = 0;
+    n->historyCount = 0;
+    n->halfmoveClock = 0;
     
     // Initialize castling rights
     n->whiteCanCastleKingside = true;
@@ -155,17 +828,70 @@ BOARD *boardSetUp(void)
     n->enPassantFile = -1;
     n->enPassantRank = -1;
     
+    n->sideToMove = WHITE;
+    n->key = computeKey(n);
+    
     return n;
 }
 
+// Sets the board up from the piece placement, side, castling and en passant fields of a FEN.
+// The board keeps the GAMEHISTORY it already points to, with the game history emptied
+bool loadFen(BOARD *chessBoard, const char *fen)
+{
+    GAMEHISTORY *history = chessBoard->history;
+    memset(chessBoard, 0, sizeof(BOARD));
+    chessBoard->history = history;
+    int x = 0, y = 0;
+    const char *c = fen;
+    for (; *c && *c != ' '; c++) {
+        if (*c == '/') {
+            x = 0;
+            y++;
+        } else if (isdigit((unsigned char)*c)) {
+            x += *c - '0';
+        } else {
+            int piece = pieceFromChar(*c);
+            if (x > 7 || y > 7 || piece == EMPTY) return false;
+            setPiece(chessBoard, x, y, piece);
+            if (*c == 'K') chessBoard->whiteKing.x = x, chessBoard->whiteKing.y = y;
+            if (*c == 'k') chessBoard->blackKing.x = x, chessBoard->blackKing.y = y;
+            x++;
+        }
+    }
+    if (*c++ != ' ') return false;
+    
+    chessBoard->sideToMove = (*c == 'b') ? BLACK : WHITE;
+    if (*c) c++;
+    while (*c == ' ') c++;
+    for (; *c && *c != ' '; c++) {
+        if (*c == 'K') chessBoard->whiteCanCastleKingside = true;
+        if (*c == 'Q') chessBoard->whiteCanCastleQueenside = true;
+        if (*c == 'k') chessBoard->blackCanCastleKingside = true;
+        if (*c == 'q') chessBoard->blackCanCastleQueenside = true;
+    }
+    while (*c == ' ') c++;
+    chessBoard->enPassantFile = -1;
+    chessBoard->enPassantRank = -1;
+    if (*c >= 'a' && *c <= 'h' && c[1] >= '1' && c[1] <= '8') {
+        chessBoard->enPassantFile = *c - 'a';
+        chessBoard->enPassantRank = '8' - c[1];
+    }
+    
+    // Past the opening book, whatever the move number
+    chessBoard->moveCount = 100;
+    chessBoard->key = computeKey(chessBoard);
+    updateAttackMap(chessBoard);
+    return true;
+}
+
 bool playPiece(int coordStart, int coordDestination, BOARD *chessBoard)
 {
     int startX = coordStart % 10, startY = coordStart / 10;
     int endX = coordDestination % 10, endY = coordDestination / 10;
-    char movedPiece = chessBoard->board[startY][startX].piece;
+    int movedPiece = chessBoard->board[startY][startX];
     
     // Basic validation first
-    if (movedPiece == ' ' || startX < 0 || startX > 7 || startY < 0 || startY > 7 || 
+    if (movedPiece == EMPTY || startX < 0 || startX > 7 || startY < 0 || startY > 7 || 
         endX < 0 || endX > 7 || endY < 0 || endY > 7) {
         return false;
     }
@@ -175,131 +901,47 @@ bool playPiece(int coordStart, int coordDestination, BOARD *chessBoard)
         return false;
     }
     
-    // Create a test board to validate the move doesn't leave king in check
-    BOARD *testBoard = copyBoard(chessBoard);
     MOVE move;
     move.from = coordStart;
     move.to = coordDestination;
     move.movedPiece = movedPiece;
-    move.capturedPiece = chessBoard->board[endY][endX].piece;
-    move.promotionPiece = ' ';
+    move.capturedPiece = chessBoard->board[endY][endX];
+    move.promotionPiece = EMPTY;
     move.isCastling = false;
     move.isEnPassant = false;
     
     // Check for special moves
-    if (tolower(movedPiece) == 'k' && abs(endX - startX) == 2) {
+    if (pieceType(movedPiece) == KING && abs(endX - startX) == 2) {
         move.isCastling = true;
-    } else if (tolower(movedPiece) == 'p' && abs(endX - startX) == 1 && 
-               chessBoard->board[endY][endX].piece == ' ' &&
+    } else if (pieceType(movedPiece) == PAWN && abs(endX - startX) == 1 && 
+               chessBoard->board[endY][endX] == EMPTY &&
                chessBoard->enPassantFile == endX) {
         move.isEnPassant = true;
     }
     
-    // Make the move on test board
-    makeMove(testBoard, move);
-    
-    // Check if this leaves the king in check
-    bool leavesKingInCheck = moveLeavesKingInCheck(testBoard, isupper(movedPiece) ? 0 : 1);
-    freeBoard(testBoard);
+    // Try the move and take it back to see whether it leaves the king in check
+    makeMove(chessBoard, move);
+    bool leavesKingInCheck = moveLeavesKingInCheck(chessBoard, pieceColor(movedPiece));
+    undoMove(chessBoard, move);
     
     if (leavesKingInCheck) {
         return false;
     }
     
-    // Move is legal, now execute it on the real board
-    if (move.isCastling) {
-        // Handle castling
-        bool kingside = (endX > startX);
-        
-        // Move king
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
-        
-        // Move rook
-        if (kingside) {
-            chessBoard->board[startY][endX-1] = chessBoard->board[startY][7];
-            chessBoard->board[startY][7].piece = ' ';
-            chessBoard->board[startY][7].live = false;
-        } else {
-            chessBoard->board[startY][endX+1] = chessBoard->board[startY][0];
-            chessBoard->board[startY][0].piece = ' ';
-            chessBoard->board[startY][0].live = false;
-        }
-        
-        // Update king position and castling rights
-        if (isupper(movedPiece)) {
-            chessBoard->whiteKing.x = endX;
-            chessBoard->whiteKing.y = endY;
-            chessBoard->whiteCanCastleKingside = false;
-            chessBoard->whiteCanCastleQueenside = false;
-            chessBoard->whiteCastled = true;
-        } else {
-            chessBoard->blackKing.x = endX;
-            chessBoard->blackKing.y = endY;
-            chessBoard->blackCanCastleKingside = false;
-            chessBoard->blackCanCastleQueenside = false;
-            chessBoard->blackCastled = true;
-        }
-    } else if (move.isEnPassant) {
-        // Handle en passant
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
-        
-        // Remove captured pawn
-        int capturedPawnY = isupper(movedPiece) ? endY + 1 : endY - 1;
-        chessBoard->board[capturedPawnY][endX].piece = ' ';
-        chessBoard->board[capturedPawnY][endX].live = false;
-    } else {
-        // Regular move
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
-        chessBoard->board[endY][endX].live = true;
-        
-        // Handle pawn promotion
-        if (tolower(movedPiece) == 'p' && (endY == 0 || endY == 7)) {
-            printf("Pawn promotion! Choose piece (Q/R/B/N): ");
-            char promotion;
-            scanf(" %c", &promotion);
-            promotion = toupper(promotion);
-            if (promotion != 'Q' && promotion != 'R' && promotion != 'B' && promotion != 'N') {
-                promotion = 'Q';
-            }
-            chessBoard->board[endY][endX].piece = isupper(movedPiece) ? promotion : tolower(promotion);
-        }
-    }
-    
-    // Update king position for regular moves
-    if (tolower(movedPiece) == 'k' && !move.isCastling) {
-        if (isupper(movedPiece)) {
-            chessBoard->whiteKing.x = endX;
-            chessBoard->whiteKing.y = endY;
-            chessBoard->whiteCanCastleKingside = false;
-            chessBoard->whiteCanCastleQueenside = false;
-        } else {
-            chessBoard->blackKing.x = endX;
-            chessBoard->blackKing.y = endY;
-            chessBoard->blackCanCastleKingside = false;
-            chessBoard->blackCanCastleQueenside = false;
+    // Handle pawn promotion
+    if (pieceType(movedPiece) == PAWN && (endY == 0 || endY == 7)) {
+        printf("Pawn promotion! Choose piece (Q/R/B/N): ");
+        char promotion;
+        scanf(" %c", &promotion);
+        int type = pieceType(pieceFromChar(toupper(promotion)));
+        if (type != QUEEN && type != ROOK && type != BISHOP && type != KNIGHT) {
+            type = QUEEN;
         }
+        move.promotionPiece = MAKE_PIECE(pieceColor(movedPiece), type);
     }
     
-    // Update castling rights if rook moves
-    if (tolower(movedPiece) == 'r') {
-        if (startX == 0 && startY == 0) chessBoard->blackCanCastleQueenside = false;
-        if (startX == 7 && startY == 0) chessBoard->blackCanCastleKingside = false;
-        if (startX == 0 && startY == 7) chessBoard->whiteCanCastleQueenside = false;
-        if (startX == 7 && startY == 7) chessBoard->whiteCanCastleKingside = false;
-    }
-    
-    // Set en passant target if pawn moves two squares
-    chessBoard->enPassantFile = -1;
-    if (tolower(movedPiece) == 'p' && abs(endY - startY) == 2) {
-        chessBoard->enPassantFile = startX;
-        chessBoard->enPassantRank = (startY + endY) / 2;
-    }
+    // Move is legal, now play it for real
+    makeMove(chessBoard, move);
     
     return true;
 }
@@ -308,10 +950,10 @@ bool isCastle(int coordStart, int coordDestination, BOARD *chessBoard)
 {
     int startX = coordStart % 10, startY = coordStart / 10;
     int endX = coordDestination % 10, endY = coordDestination / 10;
-    char piece = chessBoard->board[startY][startX].piece;
+    int piece = chessBoard->board[startY][startX];
     
     // Must be king moving
-    if (tolower(piece) != 'k') return false;
+    if (piece == EMPTY || pieceType(piece) != KING) return false;
     
     // Must move exactly 2 squares horizontally
     if (abs(endX - startX) != 2 || startY != endY) return false;
@@ -348,6 +990,7 @@ void startGame()
         // Avoid memory leak - just increment counter
         sanityValidateBoard(gameBoard, "after player");
         gameBoard->moveCount++;
+        trimHistory(gameBoard);
         updateAttackMap(gameBoard);
         sanityValidateBoard(gameBoard, "after player"); //comment out after debugging
         
@@ -359,6 +1002,7 @@ void startGame()
         
         playChecker = false;
         ai_playPiece(&ai_score, gameBoard);
+        trimHistory(gameBoard);
         updateAttackMap(gameBoard);
         sanityValidateBoard(gameBoard, "after AI"); //comment out after debugging
     }
@@ -399,218 +1043,49 @@ bool moveParsing(char *move, int coordRecorder[])
 
 void updateAttackMap(BOARD *chessBoard)
 {
-    // Clear attack maps
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            chessBoard->whiteAttacks[i][j] = false;
-            chessBoard->blackAttacks[i][j] = false;
+    for (int color = WHITE; color <= BLACK; color++) {
+        U64 *pieceBB = chessBoard->pieceBB[color];
+        U64 attacks = 0;
+        
+        // Pawns attack diagonally, all of them at once
+        if (color == WHITE) {
+            attacks |= ((pieceBB[PAWN] & ~FILE_A_BB) >> 9) | ((pieceBB[PAWN] & ~FILE_H_BB) >> 7);
+        } else {
+            attacks |= ((pieceBB[PAWN] & ~FILE_H_BB) << 9) | ((pieceBB[PAWN] & ~FILE_A_BB) << 7);
         }
+        
+        U64 bb = pieceBB[KNIGHT];
+        while (bb) attacks |= knightAttacks[popLsb(&bb)];
+        
+        bb = pieceBB[BISHOP] | pieceBB[QUEEN];
+        while (bb) attacks |= bishopAttacks(popLsb(&bb), chessBoard->occupied);
+        
+        bb = pieceBB[ROOK] | pieceBB[QUEEN];
+        while (bb) attacks |= rookAttacks(popLsb(&bb), chessBoard->occupied);
+        
+        bb = pieceBB[KING];
+        while (bb) attacks |= kingAttacks[popLsb(&bb)];
+        
+        chessBoard->attacks[color] = attacks;
     }
-    
-    // Generate attack maps manually without recursion to avoid infinite loops
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece == ' ') continue;
-            
-            bool isWhite = isupper(piece);
-            
-            switch (tolower(piece)) {
-                case 'p': {
-                    // Pawn attacks diagonally
-                    int direction = isWhite ? -1 : 1;
-                    if (y + direction >= 0 && y + direction < 8) {
-                        if (x > 0 && isWhite) chessBoard->whiteAttacks[y + direction][x - 1] = true;
-                        if (x < 7 && isWhite) chessBoard->whiteAttacks[y + direction][x + 1] = true;
-                        if (x > 0 && !isWhite) chessBoard->blackAttacks[y + direction][x - 1] = true;
-                        if (x < 7 && !isWhite) chessBoard->blackAttacks[y + direction][x + 1] = true;
-                    }
-                    break;
-                }
-                case 'r': {
-                    // Rook attacks horizontally and vertically
-                    for (int i = 1; i < 8; i++) {
-                        // Right
-                        if (x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y][x + i] = true;
-                            else chessBoard->blackAttacks[y][x + i] = true;
-                            if (chessBoard->board[y][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Left
-                        if (x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y][x - i] = true;
-                            else chessBoard->blackAttacks[y][x - i] = true;
-                            if (chessBoard->board[y][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Up
-                        if (y - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x] = true;
-                            else chessBoard->blackAttacks[y - i][x] = true;
-                            if (chessBoard->board[y - i][x].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Down
-                        if (y + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x] = true;
-                            else chessBoard->blackAttacks[y + i][x] = true;
-                            if (chessBoard->board[y + i][x].piece != ' ') break;
-                        } else break;
-                    }
-                    break;
-                }
-                case 'n': {
-                    // Knight attacks
-                    int knightMoves[8][2] = {{-2,-1},{-2,1},{-1,-2},{-1,2},{1,-2},{1,2},{2,-1},{2,1}};
-                    for (int i = 0; i < 8; i++) {
-                        int ny = y + knightMoves[i][0];
-                        int nx = x + knightMoves[i][1];
-                        if (ny >= 0 && ny < 8 && nx >= 0 && nx < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[ny][nx] = true;
-                            else chessBoard->blackAttacks[ny][nx] = true;
-                        }
-                    }
-                    break;
-                }
-                case 'b': {
-                    // Bishop attacks diagonally
-                    for (int i = 1; i < 8; i++) {
-                        // Up-right
-                        if (y - i >= 0 && x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x + i] = true;
-                            else chessBoard->blackAttacks[y - i][x + i] = true;
-                            if (chessBoard->board[y - i][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Up-left
-                        if (y - i >= 0 && x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x - i] = true;
-                            else chessBoard->blackAttacks[y - i][x - i] = true;
-                            if (chessBoard->board[y - i][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Down-right
-                        if (y + i < 8 && x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x + i] = true;
-                            else chessBoard->blackAttacks[y + i][x + i] = true;
-                            if (chessBoard->board[y + i][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        // Down-left
-                        if (y + i < 8 && x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x - i] = true;
-                            else chessBoard->blackAttacks[y + i][x - i] = true;
-                            if (chessBoard->board[y + i][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    break;
-                }
-                case 'q': {
-                    // Queen = Rook + Bishop attacks (combined logic)
-                    // Rook-like moves
-                    for (int i = 1; i < 8; i++) {
-                        if (x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y][x + i] = true;
-                            else chessBoard->blackAttacks[y][x + i] = true;
-                            if (chessBoard->board[y][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y][x - i] = true;
-                            else chessBoard->blackAttacks[y][x - i] = true;
-                            if (chessBoard->board[y][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (y - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x] = true;
-                            else chessBoard->blackAttacks[y - i][x] = true;
-                            if (chessBoard->board[y - i][x].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (y + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x] = true;
-                            else chessBoard->blackAttacks[y + i][x] = true;
-                            if (chessBoard->board[y + i][x].piece != ' ') break;
-                        } else break;
-                    }
-                    // Bishop-like moves
-                    for (int i = 1; i < 8; i++) {
-                        if (y - i >= 0 && x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x + i] = true;
-                            else chessBoard->blackAttacks[y - i][x + i] = true;
-                            if (chessBoard->board[y - i][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (y - i >= 0 && x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y - i][x - i] = true;
-                            else chessBoard->blackAttacks[y - i][x - i] = true;
-                            if (chessBoard->board[y - i][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (y + i < 8 && x + i < 8) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x + i] = true;
-                            else chessBoard->blackAttacks[y + i][x + i] = true;
-                            if (chessBoard->board[y + i][x + i].piece != ' ') break;
-                        } else break;
-                    }
-                    for (int i = 1; i < 8; i++) {
-                        if (y + i < 8 && x - i >= 0) {
-                            if (isWhite) chessBoard->whiteAttacks[y + i][x - i] = true;
-                            else chessBoard->blackAttacks[y + i][x - i] = true;
-                            if (chessBoard->board[y + i][x - i].piece != ' ') break;
-                        } else break;
-                    }
-                    break;
-                }
-                case 'k': {
-                    // King attacks adjacent squares
-                    for (int dy = -1; dy <= 1; dy++) {
-                        for (int dx = -1; dx <= 1; dx++) {
-                            if (dy == 0 && dx == 0) continue;
-                            int ny = y + dy, nx = x + dx;
-                            if (ny >= 0 && ny < 8 && nx >= 0 && nx < 8) {
-                                if (isWhite) chessBoard->whiteAttacks[ny][nx] = true;
-                                else chessBoard->blackAttacks[ny][nx] = true;
-                            }
-                        }
-                    }
-                    break;
-                }
-            }
-        }
-    }
-}
-
-int evaluateBoard(BOARD *chessBoard)
-{
-    int score = 0;
+}
+
+// Number of pieces on the board other than the kings
+int countMaterial(BOARD *chessBoard)
+{
+    U64 kings = chessBoard->pieceBB[WHITE][KING] | chessBoard->pieceBB[BLACK][KING];
+    return popCount(chessBoard->occupied & ~kings);
+}
+
+int evaluateBoard(BOARD *chessBoard)
+{
+    int score = 0;
     
     // Count material to determine game phase
-    int materialCount = 0;
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece != ' ' && tolower(piece) != 'k') {
-                materialCount++;
-            }
-        }
-    }
-    bool isEndgame = materialCount <= 12;
+    bool isEndgame = countMaterial(chessBoard) <= ENDGAME_MATERIAL;
     
     // Different king tables for opening/endgame
-    int kingTableOpening[8][8] = {
+    static const int kingTableOpening[8][8] = {
         {-30,-40,-40,-50,-50,-40,-40,-30},
         {-30,-40,-40,-50,-50,-40,-40,-30},
         {-30,-40,-40,-50,-50,-40,-40,-30},
@@ -621,7 +1096,7 @@ int evaluateBoard(BOARD *chessBoard)
         { 20, 30, 10,  0,  0, 10, 30, 20}
     };
     
-    int kingTableEndgame[8][8] = {
+    static const int kingTableEndgame[8][8] = {
         {-50,-40,-30,-20,-20,-30,-40,-50},
         {-30,-20,-10,  0,  0,-10,-20,-30},
         {-30,-10, 20, 30, 30, 20,-10,-30},
@@ -633,7 +1108,7 @@ int evaluateBoard(BOARD *chessBoard)
     };
     
     // Piece-square tables for positional evaluation
-    int pawnTable[8][8] = {
+    static const int pawnTable[8][8] = {
         {0,  0,  0,  0,  0,  0,  0,  0},
         {50, 50, 50, 50, 50, 50, 50, 50},
         {10, 10, 20, 30, 30, 20, 10, 10},
@@ -644,7 +1119,7 @@ int evaluateBoard(BOARD *chessBoard)
         {0,  0,  0,  0,  0,  0,  0,  0}
     };
     
-    int knightTable[8][8] = {
+    static const int knightTable[8][8] = {
         {-50,-40,-30,-30,-30,-30,-40,-50},
         {-40,-20,  0,  0,  0,  0,-20,-40},
         {-30,  0, 10, 15, 15, 10,  0,-30},
@@ -656,145 +1131,110 @@ int evaluateBoard(BOARD *chessBoard)
     };
     
     // Track special features
-    int whiteBishops = 0, blackBishops = 0;
-    int whiteRooks = 0, blackRooks = 0;
-    
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece == ' ') continue;
-            
-            int pieceValue = 0;
-            int positionalValue = 0;
-            
-            // Check if piece is hanging using precomputed attack maps
-            bool isPieceWhite = isupper(piece);
-            bool isUnderAttack = isPieceWhite ? chessBoard->blackAttacks[y][x] : chessBoard->whiteAttacks[y][x];
-            bool isDefended = isPieceWhite ? chessBoard->whiteAttacks[y][x] : chessBoard->blackAttacks[y][x];
-            
-            if (isUnderAttack && !isDefended) {
-                int hangingValue = getPieceValue(piece) * 100; // Penalty for hanging pieces
-                if (isPieceWhite) {
-                    score += hangingValue; // White piece hanging is bad for white
-                } else {
-                    score -= hangingValue; // Black piece hanging is good for white
-                }
+    int whiteBishops = popCount(chessBoard->pieceBB[WHITE][BISHOP]), blackBishops = popCount(chessBoard->pieceBB[BLACK][BISHOP]);
+    int whiteRooks = popCount(chessBoard->pieceBB[WHITE][ROOK]), blackRooks = popCount(chessBoard->pieceBB[BLACK][ROOK]);
+    U64 allPawns = chessBoard->pieceBB[WHITE][PAWN] | chessBoard->pieceBB[BLACK][PAWN];
+    
+    // pieceBB holds each side's pieces grouped by type, kept current by setPiece/clearSquare,
+    // so the walk below visits only pieces on the board and never has to look up what they are
+    for (int color = WHITE; color <= BLACK; color++) {
+        bool isPieceWhite = (color == WHITE);
+        
+        // Hanging pieces (attacked and undefended, per the precomputed attack maps), for the whole side at once
+        U64 hanging = chessBoard->colorBB[color] & chessBoard->attacks[color ^ 1] & ~chessBoard->attacks[color];
+        
+        for (int type = PAWN; type <= KING; type++) {
+            if (type != KING) {
+                int hangingValue = popCount(hanging & chessBoard->pieceBB[color][type]) * pieceTypeValues[type] * 100;
+                score += isPieceWhite ? hangingValue : -hangingValue; // White piece hanging is bad for white
             }
             
-            switch (tolower(piece)) {
-                case 'p': 
-                    pieceValue = VALUE_PAWN;
-                    
-                    // Check for passed pawn
-                    bool passed = true;
-                    int direction = isupper(piece) ? -1 : 1;
-                    for (int py = y + direction; py >= 0 && py < 8; py += direction) {
-                        for (int px = (x > 0 ? x-1 : 0); px <= (x < 7 ? x+1 : 7); px++) {
-                            char enemyPiece = chessBoard->board[py][px].piece;
-                            if (enemyPiece == (isupper(piece) ? 'p' : 'P')) {
-                                passed = false;
-                                break;
-                            }
+            U64 pieces = chessBoard->pieceBB[color][type];
+            while (pieces) {
+                int sq = popLsb(&pieces);
+                int x = sq % 8, y = sq / 8;
+                U64 bit = SQUARE_BIT(sq);
+                
+                int pieceValue = 0;
+                int positionalValue = 0;
+                
+                switch (type) {
+                    case PAWN: {
+                        U64 ownPawns = chessBoard->pieceBB[color][PAWN];
+                        pieceValue = VALUE_PAWN;
+                
+                        // Passed pawn: no enemy pawn ahead on this file or the neighbouring ones
+                        bool passed = (passedPawnMask[color][sq] & chessBoard->pieceBB[color ^ 1][PAWN]) == 0;
+                        if (passed && (isPieceWhite ? y > 3 : y < 4)) {
+                            pieceValue += VALUE_PASSED_PAWN;
                         }
-                        if (!passed) break;
-                    }
-                    if (passed && (isupper(piece) ? y > 3 : y < 4)) {
-                        pieceValue += VALUE_PASSED_PAWN;
+                
+                        // Check for doubled pawns
+                        if (ownPawns & (FILE_A_BB << x) & ~bit) pieceValue -= PENALTY_DOUBLED_PAWN;
+                
+                        // Check for isolated pawns
+                        if ((ownPawns & adjacentFilesBB[x]) == 0) pieceValue -= PENALTY_ISOLATED_PAWN;
+                
+                        positionalValue = isPieceWhite ? pawnTable[7-y][x] : pawnTable[y][x];
+                        break;
                     }
-                    
-                    // Check for doubled pawns
-                    bool doubled = false;
-                    for (int py = 0; py < 8; py++) {
-                        if (py != y && chessBoard->board[py][x].piece == piece) {
-                            doubled = true;
-                            break;
+                
+                    case KNIGHT: 
+                        pieceValue = VALUE_KNIGHT;
+                        positionalValue = isPieceWhite ? knightTable[7-y][x] : knightTable[y][x];
+                        break;
+                
+                    case BISHOP: 
+                        pieceValue = VALUE_BISHOP;
+                        // Bishops prefer long diagonals
+                        if ((x == y) || (x + y == 7)) positionalValue += 10;
+                        break;
+                
+                    case ROOK: 
+                        pieceValue = VALUE_ROOK;
+                
+                        // Bonus for rook on open file
+                        if ((allPawns & (FILE_A_BB << x)) == 0) positionalValue += 20;
+                        break;
+                
+                    case QUEEN: 
+                        pieceValue = VALUE_QUEEN;
+                        // Queen centralization in endgame
+                        if (isEndgame && x >= 2 && x <= 5 && y >= 2 && y <= 5) {
+                            positionalValue += 10;
                         }
-                    }
-                    if (doubled) pieceValue -= PENALTY_DOUBLED_PAWN;
-                    
-                    // Check for isolated pawns
-                    bool isolated = true;
-                    for (int px = x-1; px <= x+1; px += 2) {
-                        if (px >= 0 && px < 8) {
-                            for (int py = 0; py < 8; py++) {
-                                if (chessBoard->board[py][px].piece == piece) {
-                                    isolated = false;
-                                    break;
-                                }
-                            }
+                
+                        // Penalty for early queen development
+                        if (!isEndgame && (isPieceWhite ? y < 6 : y > 1)) {
+                            positionalValue -= 30; // Discourage early queen moves
                         }
-                        if (!isolated) break;
-                    }
-                    if (isolated) pieceValue -= PENALTY_ISOLATED_PAWN;
-                    
-                    positionalValue = isupper(piece) ? pawnTable[7-y][x] : pawnTable[y][x];
-                    break;
-                    
-                case 'n': 
-                    pieceValue = VALUE_KNIGHT;
-                    positionalValue = isupper(piece) ? knightTable[7-y][x] : knightTable[y][x];
-                    break;
-                    
-                case 'b': 
-                    pieceValue = VALUE_BISHOP;
-                    if (isupper(piece)) whiteBishops++; else blackBishops++;
-                    // Bishops prefer long diagonals
-                    if ((x == y) || (x + y == 7)) positionalValue += 10;
-                    break;
-                    
-                case 'r': 
-                    pieceValue = VALUE_ROOK;
-                    if (isupper(piece)) whiteRooks++; else blackRooks++;
-                    
-                    // Bonus for rook on open file
-                    bool openFile = true;
-                    for (int ry = 0; ry < 8; ry++) {
-                        if (chessBoard->board[ry][x].piece == 'p' || chessBoard->board[ry][x].piece == 'P') {
-                            openFile = false;
-                            break;
+                        break;
+                
+                    case KING: 
+                        // Both sides always have one, so the king carries no material
+                        // Use different king tables for different game phases
+                        if (isEndgame) {
+                            positionalValue = isPieceWhite ? kingTableEndgame[7-y][x] : kingTableEndgame[y][x];
+                        } else {
+                            positionalValue = isPieceWhite ? kingTableOpening[7-y][x] : kingTableOpening[y][x];
                         }
-                    }
-                    if (openFile) positionalValue += 20;
-                    break;
-                    
-                case 'q': 
-                    pieceValue = VALUE_QUEEN;
-                    // Queen centralization in endgame
-                    if (isEndgame && x >= 2 && x <= 5 && y >= 2 && y <= 5) {
-                        positionalValue += 10;
-                    }
-                    
-                    // Penalty for early queen development
-                    if (!isEndgame && (isupper(piece) ? y < 6 : y > 1)) {
-                        positionalValue -= 30; // Discourage early queen moves
-                    }
-                    break;
-                    
-                case 'k': 
-                    pieceValue = VALUE_KING;
-                    
-                    // Use different king tables for different game phases
-                    if (isEndgame) {
-                        positionalValue = isupper(piece) ? kingTableEndgame[7-y][x] : kingTableEndgame[y][x];
-                    } else {
-                        positionalValue = isupper(piece) ? kingTableOpening[7-y][x] : kingTableOpening[y][x];
-                    }
-                    
-                    // Castling bonus
-                    if (isupper(piece) && chessBoard->whiteCastled) {
-                        positionalValue += VALUE_CASTLED_KING;
-                    } else if (!isupper(piece) && chessBoard->blackCastled) {
-                        positionalValue += VALUE_CASTLED_KING;
-                    }
-                    break;
-            }
-            
-            int totalValue = (pieceValue * 100 + positionalValue) / 100;
-            
-            if (isupper(piece)) {
-                score -= totalValue;
-            } else {
-                score += totalValue;
+                
+                        // Castling bonus
+                        if (isPieceWhite && chessBoard->whiteCastled) {
+                            positionalValue += VALUE_CASTLED_KING;
+                        } else if (!isPieceWhite && chessBoard->blackCastled) {
+                            positionalValue += VALUE_CASTLED_KING;
+                        }
+                        break;
+                }
+        
+                int totalValue = (pieceValue * 100 + positionalValue) / 100;
+        
+                if (isPieceWhite) {
+                    score -= totalValue;
+                } else {
+                    score += totalValue;
+                }
             }
         }
     }
@@ -808,57 +1248,88 @@ int evaluateBoard(BOARD *chessBoard)
     if (blackRooks >= 2) score += BONUS_CONNECTED_ROOKS / 2;
     
     // Simple mobility evaluation - just count attacked squares
-    int whiteMobility = 0, blackMobility = 0;
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            if (chessBoard->whiteAttacks[y][x]) whiteMobility++;
-            if (chessBoard->blackAttacks[y][x]) blackMobility++;
-        }
-    }
+    int whiteMobility = popCount(chessBoard->attacks[WHITE]);
+    int blackMobility = popCount(chessBoard->attacks[BLACK]);
     score += (blackMobility - whiteMobility) / 4; // Reduced mobility weight
     
-    return score;
+    // The terms above are summed from black's side; the search wants the side to move's
+    return (chessBoard->sideToMove == BLACK) ? score : -score;
 }
 
-BOARD* copyBoard(BOARD *original)
+// Pushes everything undoMove/undoNullMove need to put back that the move itself does not record
+static inline void pushUndoState(BOARD *chessBoard, int capturedPiece)
 {
-    BOARD *copy = malloc(sizeof(BOARD));
-    memcpy(copy, original, sizeof(BOARD));
-    return copy;
+    UNDOSTATE *state = &chessBoard->history->states[chessBoard->historyCount++];
+    
+    state->key = chessBoard->key;
+    state->halfmoveClock = chessBoard->halfmoveClock;
+    state->enPassantFile = chessBoard->enPassantFile;
+    state->enPassantRank = chessBoard->enPassantRank;
+    state->capturedPiece = capturedPiece;
+    state->whiteCanCastleKingside = chessBoard->whiteCanCastleKingside;
+    state->whiteCanCastleQueenside = chessBoard->whiteCanCastleQueenside;
+    state->blackCanCastleKingside = chessBoard->blackCanCastleKingside;
+    state->blackCanCastleQueenside = chessBoard->blackCanCastleQueenside;
+    state->whiteCastled = chessBoard->whiteCastled;
+    state->blackCastled = chessBoard->blackCastled;
 }
 
-void freeBoard(BOARD *board)
+// Pops the newest record back into the board; the pieces must already be back in place
+static inline void popUndoState(BOARD *chessBoard)
 {
-    free(board);
+    UNDOSTATE *state = &chessBoard->history->states[--chessBoard->historyCount];
+    
+    chessBoard->key = state->key;
+    chessBoard->halfmoveClock = state->halfmoveClock;
+    chessBoard->enPassantFile = state->enPassantFile;
+    chessBoard->enPassantRank = state->enPassantRank;
+    chessBoard->whiteCanCastleKingside = state->whiteCanCastleKingside;
+    chessBoard->whiteCanCastleQueenside = state->whiteCanCastleQueenside;
+    chessBoard->blackCanCastleKingside = state->blackCanCastleKingside;
+    chessBoard->blackCanCastleQueenside = state->blackCanCastleQueenside;
+    chessBoard->whiteCastled = state->whiteCastled;
+    chessBoard->blackCastled = state->blackCastled;
+    chessBoard->sideToMove ^= 1;
 }
 
 bool makeMove(BOARD *chessBoard, MOVE move)
 {
     int startX = move.from % 10, startY = move.from / 10;
     int endX = move.to % 10, endY = move.to / 10;
+    int oldCastling = castlingIndex(chessBoard);
+    int capturedPiece = move.isEnPassant ? chessBoard->board[startY][endX] : chessBoard->board[endY][endX];
+    int movedType = pieceType(move.movedPiece);
+    bool isWhite = pieceColor(move.movedPiece) == WHITE;
+    
+    // Remember the position for repetition checks and everything undoMove has to restore
+    pushUndoState(chessBoard, capturedPiece);
+    if (movedType == PAWN || capturedPiece != EMPTY) {
+        chessBoard->halfmoveClock = 0;
+    } else {
+        chessBoard->halfmoveClock++;
+    }
     
     if (move.isCastling) {
         // Handle castling
         bool kingside = (endX > startX);
         
         // Move king
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
+        clearSquare(chessBoard, startX, startY);
+        setPiece(chessBoard, endX, endY, move.movedPiece);
         
         // Move rook
         if (kingside) {
-            chessBoard->board[startY][endX-1] = chessBoard->board[startY][7];
-            chessBoard->board[startY][7].piece = ' ';
-            chessBoard->board[startY][7].live = false;
+            int rook = chessBoard->board[startY][7];
+            clearSquare(chessBoard, 7, startY);
+            setPiece(chessBoard, endX-1, startY, rook);
         } else {
-            chessBoard->board[startY][endX+1] = chessBoard->board[startY][0];
-            chessBoard->board[startY][0].piece = ' ';
-            chessBoard->board[startY][0].live = false;
+            int rook = chessBoard->board[startY][0];
+            clearSquare(chessBoard, 0, startY);
+            setPiece(chessBoard, endX+1, startY, rook);
         }
         
         // Update king position and castling rights
-        if (isupper(move.movedPiece)) {
+        if (isWhite) {
             chessBoard->whiteKing.x = endX;
             chessBoard->whiteKing.y = endY;
             chessBoard->whiteCanCastleKingside = false;
@@ -873,30 +1344,24 @@ bool makeMove(BOARD *chessBoard, MOVE move)
         }
     } else if (move.isEnPassant) {
         // Handle en passant
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
+        clearSquare(chessBoard, startX, startY);
+        setPiece(chessBoard, endX, endY, move.movedPiece);
         
         // Remove captured pawn
-        int capturedPawnY = isupper(move.movedPiece) ? endY + 1 : endY - 1;
-        chessBoard->board[capturedPawnY][endX].piece = ' ';
-        chessBoard->board[capturedPawnY][endX].live = false;
+        int capturedPawnY = isWhite ? endY + 1 : endY - 1;
+        clearSquare(chessBoard, endX, capturedPawnY);
     } else {
         // Regular move
-        chessBoard->board[endY][endX] = chessBoard->board[startY][startX];
-        chessBoard->board[startY][startX].piece = ' ';
-        chessBoard->board[startY][startX].live = false;
-        chessBoard->board[endY][endX].live = true;
+        clearSquare(chessBoard, startX, startY);
+        clearSquare(chessBoard, endX, endY);
         
         // Handle pawn promotion
-        if (move.promotionPiece != ' ') {
-            chessBoard->board[endY][endX].piece = move.promotionPiece;
-        }
+        setPiece(chessBoard, endX, endY, move.promotionPiece != EMPTY ? move.promotionPiece : move.movedPiece);
     }
     
     // Update king position for regular moves
-    if (tolower(move.movedPiece) == 'k' && !move.isCastling) {
-        if (isupper(move.movedPiece)) {
+    if (movedType == KING && !move.isCastling) {
+        if (isWhite) {
             chessBoard->whiteKing.x = endX;
             chessBoard->whiteKing.y = endY;
             chessBoard->whiteCanCastleKingside = false;
@@ -910,13 +1375,36 @@ bool makeMove(BOARD *chessBoard, MOVE move)
     }
     
     // Update castling rights if rook moves
-    if (tolower(move.movedPiece) == 'r') {
+    if (movedType == ROOK) {
         if (startX == 0 && startY == 0) chessBoard->blackCanCastleQueenside = false;
         if (startX == 7 && startY == 0) chessBoard->blackCanCastleKingside = false;
         if (startX == 0 && startY == 7) chessBoard->whiteCanCastleQueenside = false;
         if (startX == 7 && startY == 7) chessBoard->whiteCanCastleKingside = false;
     }
     
+    // ... or gets captured on its starting square
+    if (capturedPiece != EMPTY && pieceType(capturedPiece) == ROOK) {
+        if (endX == 0 && endY == 0) chessBoard->blackCanCastleQueenside = false;
+        if (endX == 7 && endY == 0) chessBoard->blackCanCastleKingside = false;
+        if (endX == 0 && endY == 7) chessBoard->whiteCanCastleQueenside = false;
+        if (endX == 7 && endY == 7) chessBoard->whiteCanCastleKingside = false;
+    }
+    
+    // A double pawn push leaves an en passant target behind; any older one expires
+    if (chessBoard->enPassantFile != -1) chessBoard->key ^= zobristEnPassant[chessBoard->enPassantFile];
+    chessBoard->enPassantFile = -1;
+    chessBoard->enPassantRank = -1;
+    if (movedType == PAWN && abs(endY - startY) == 2) {
+        chessBoard->enPassantFile = startX;
+        chessBoard->enPassantRank = (startY + endY) / 2;
+        chessBoard->key ^= zobristEnPassant[startX];
+    }
+    
+    // Pieces were hashed by setPiece/clearSquare; rights and side to move are hashed here
+    chessBoard->key ^= zobristCastling[oldCastling] ^ zobristCastling[castlingIndex(chessBoard)];
+    chessBoard->sideToMove ^= 1;
+    chessBoard->key ^= zobristBlackToMove;
+    
     return true;
 }
 
@@ -924,29 +1412,30 @@ void undoMove(BOARD *chessBoard, MOVE move)
 {
     int startX = move.from % 10, startY = move.from / 10;
     int endX = move.to % 10, endY = move.to / 10;
+    int capturedPiece = chessBoard->history->states[chessBoard->historyCount - 1].capturedPiece;
+    bool isWhite = pieceColor(move.movedPiece) == WHITE;
     
     if (move.isCastling) {
         // Undo castling
         bool kingside = (endX > startX);
         
         // Move king back
-        chessBoard->board[startY][startX] = chessBoard->board[endY][endX];
-        chessBoard->board[endY][endX].piece = ' ';
-        chessBoard->board[endY][endX].live = false;
+        clearSquare(chessBoard, endX, endY);
+        setPiece(chessBoard, startX, startY, move.movedPiece);
         
         // Move rook back
         if (kingside) {
-            chessBoard->board[startY][7] = chessBoard->board[startY][endX-1];
-            chessBoard->board[startY][endX-1].piece = ' ';
-            chessBoard->board[startY][endX-1].live = false;
+            int rook = chessBoard->board[startY][endX-1];
+            clearSquare(chessBoard, endX-1, startY);
+            setPiece(chessBoard, 7, startY, rook);
         } else {
-            chessBoard->board[startY][0] = chessBoard->board[startY][endX+1];
-            chessBoard->board[startY][endX+1].piece = ' ';
-            chessBoard->board[startY][endX+1].live = false;
+            int rook = chessBoard->board[startY][endX+1];
+            clearSquare(chessBoard, endX+1, startY);
+            setPiece(chessBoard, 0, startY, rook);
         }
         
-        // Restore king position (castling rights would need game state stack to restore properly)
-        if (isupper(move.movedPiece)) {
+        // Restore king position
+        if (isWhite) {
             chessBoard->whiteKing.x = startX;
             chessBoard->whiteKing.y = startY;
         } else {
@@ -955,29 +1444,24 @@ void undoMove(BOARD *chessBoard, MOVE move)
         }
     } else if (move.isEnPassant) {
         // Undo en passant
-        chessBoard->board[startY][startX] = chessBoard->board[endY][endX];
-        chessBoard->board[endY][endX].piece = ' ';
-        chessBoard->board[endY][endX].live = false;
+        clearSquare(chessBoard, endX, endY);
+        setPiece(chessBoard, startX, startY, move.movedPiece);
         
         // Restore captured pawn
-        int capturedPawnY = isupper(move.movedPiece) ? endY + 1 : endY - 1;
-        chessBoard->board[capturedPawnY][endX].piece = move.capturedPiece;
-        chessBoard->board[capturedPawnY][endX].live = true;
+        int capturedPawnY = isWhite ? endY + 1 : endY - 1;
+        setPiece(chessBoard, endX, capturedPawnY, capturedPiece);
     } else {
-        // Undo regular move
-        chessBoard->board[startY][startX] = chessBoard->board[endY][endX];
-        chessBoard->board[endY][endX].piece = move.capturedPiece;
-        chessBoard->board[endY][endX].live = (move.capturedPiece != ' ');
-        
-        // Restore original piece if it was a promotion
-        if (move.promotionPiece != ' ') {
-            chessBoard->board[startY][startX].piece = move.movedPiece;
+        // Undo regular move (puts the pawn back if it was a promotion)
+        clearSquare(chessBoard, endX, endY);
+        setPiece(chessBoard, startX, startY, move.movedPiece);
+        if (capturedPiece != EMPTY) {
+            setPiece(chessBoard, endX, endY, capturedPiece);
         }
     }
     
     // Restore king position for regular moves
-    if (tolower(move.movedPiece) == 'k' && !move.isCastling) {
-        if (isupper(move.movedPiece)) {
+    if (pieceType(move.movedPiece) == KING && !move.isCastling) {
+        if (isWhite) {
             chessBoard->whiteKing.x = startX;
             chessBoard->whiteKing.y = startY;
         } else {
@@ -985,1170 +1469,1136 @@ void undoMove(BOARD *chessBoard, MOVE move)
             chessBoard->blackKing.y = startY;
         }
     }
+    
+    // Rights, en passant, clock and the key itself come back from the record makeMove pushed
+    popUndoState(chessBoard);
 }
 
-void generateMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite)
+// Earlier occurrences of the current position with the same side to move. Only the plies since
+// the last capture or pawn move (or null move) are looked at: nothing older can recur
+int repetitionCount(BOARD *chessBoard)
 {
-    *moveCount = 0;
-    
-    // Generate castling moves first
-    generateCastlingMoves(chessBoard, moves, moveCount, isWhite);
-    
-    // Generate en passant moves
-    generateEnPassantMoves(chessBoard, moves, moveCount, isWhite);
+    int count = 0;
+    int oldest = chessBoard->historyCount - chessBoard->halfmoveClock;
+    if (oldest < 0) oldest = 0;
     
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece == ' ') continue;
-            
-            bool isPieceWhite = isupper(piece);
-            if (isPieceWhite != isWhite) continue;
-            
-            int from = y * 10 + x;
-            
-            for (int ty = 0; ty < 8; ty++) {
-                for (int tx = 0; tx < 8; tx++) {
-                    int to = ty * 10 + tx;
-                    if (from == to) continue;
-                    
-                    if (basicMoveChecker(from, to, chessBoard)) {
-                        // Check for pawn promotion
-                        if (tolower(piece) == 'p' && (ty == 0 || ty == 7)) {
-                            generatePromotionMoves(chessBoard, moves, moveCount, isWhite, from, to);
-                        } else {
-                            MOVE move;
-                            move.from = from;
-                            move.to = to;
-                            move.movedPiece = piece;
-                            move.capturedPiece = chessBoard->board[ty][tx].piece;
-                            move.promotionPiece = ' ';
-                            move.isCastling = false;
-                            move.isEnPassant = false;
-                            move.score = 0;
-                            
-                            // Fast check: Test if this move leaves king in check by simulating the move
-                            char originalCaptured = chessBoard->board[ty][tx].piece;
-                            bool originalLive = chessBoard->board[ty][tx].live;
-                            
-                            // Make temporary move
-                            chessBoard->board[ty][tx] = chessBoard->board[y][x];
-                            chessBoard->board[y][x].piece = ' ';
-                            chessBoard->board[y][x].live = false;
-                            
-                            // Update king position if king moved
-                            int oldKingX = -1, oldKingY = -1;
-                            bool kingMoved = false;
-                            if (tolower(piece) == 'k') {
-                                kingMoved = true;
-                                if (isWhite) {
-                                    oldKingX = chessBoard->whiteKing.x;
-                                    oldKingY = chessBoard->whiteKing.y;
-                                    chessBoard->whiteKing.x = tx;
-                                    chessBoard->whiteKing.y = ty;
-                                } else {
-                                    oldKingX = chessBoard->blackKing.x;
-                                    oldKingY = chessBoard->blackKing.y;
-                                    chessBoard->blackKing.x = tx;
-                                    chessBoard->blackKing.y = ty;
-                                }
-                            }
-                            
-                            bool leavesKingInCheck = moveLeavesKingInCheck(chessBoard, isWhite ? 0 : 1);
-                            
-                            // Restore board state
-                            chessBoard->board[y][x] = chessBoard->board[ty][tx];
-                            chessBoard->board[ty][tx].piece = originalCaptured;
-                            chessBoard->board[ty][tx].live = originalLive;
-                            
-                            // Restore king position if needed
-                            if (kingMoved) {
-                                if (isWhite) {
-                                    chessBoard->whiteKing.x = oldKingX;
-                                    chessBoard->whiteKing.y = oldKingY;
-                                } else {
-                                    chessBoard->blackKing.x = oldKingX;
-                                    chessBoard->blackKing.y = oldKingY;
-                                }
-                            }
-                            
-                            if (!leavesKingInCheck) {
-                                moves[(*moveCount)++] = move;
-                                if (*moveCount >= 200) {
-                                    return;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    for (int i = chessBoard->historyCount - 2; i >= oldest; i -= 2) {
+        if (chessBoard->history->states[i].key == chessBoard->key) count++;
     }
+    return count;
 }
 
-int quiescence(BOARD *chessBoard, int alpha, int beta, bool maximizingPlayer)
+// Repetition draw inside the search. A position seen earlier on the current search path is a
+// draw at once, since whoever repeated it once can keep repeating; one seen only before the
+// root still needs two earlier occurrences, as in the game itself
+bool isSearchRepetition(BOARD *chessBoard, int ply)
 {
-    int standPat = evaluateBoard(chessBoard);
+    int count = 0;
+    int oldest = chessBoard->historyCount - chessBoard->halfmoveClock;
+    if (oldest < 0) oldest = 0;
     
-    if (maximizingPlayer) {
-        if (standPat >= beta) return beta;
-        if (alpha < standPat) alpha = standPat;
-    } else {
-        if (standPat <= alpha) return alpha;
-        if (beta > standPat) beta = standPat;
+    for (int i = chessBoard->historyCount - 2; i >= oldest; i -= 2) {
+        if (chessBoard->history->states[i].key != chessBoard->key) continue;
+        if (i > chessBoard->historyCount - ply || ++count >= 2) return true;
     }
+    return false;
+}
+
+// Drops game history that repetitionCount() can no longer reach, so long games fit the arrays
+void trimHistory(BOARD *chessBoard)
+{
+    int keep = chessBoard->halfmoveClock;
+    int drop = chessBoard->historyCount - keep;
+    if (drop <= 0) return;
     
-    // Generate only captures for quiescence search
-    MOVE moves[200];
-    int moveCount = 0;
-    
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece == ' ') continue;
-            
-            bool isPieceWhite = isupper(piece);
-            if (isPieceWhite != maximizingPlayer) continue;
-            
-            int from = y * 10 + x;
-            
-            for (int ty = 0; ty < 8; ty++) {
-                for (int tx = 0; tx < 8; tx++) {
-                    int to = ty * 10 + tx;
-                    if (from == to) continue;
-                    
-                    // Only consider captures
-                    if (chessBoard->board[ty][tx].piece == ' ') continue;
-                    
-                    if (basicMoveChecker(from, to, chessBoard)) {
-                        MOVE move;
-                        move.from = from;
-                        move.to = to;
-                        move.movedPiece = piece;
-                        move.capturedPiece = chessBoard->board[ty][tx].piece;
-                        move.promotionPiece = ' ';
-                        move.isCastling = false;
-                        move.isEnPassant = false;
-                        move.score = 0;
-                        
-                        // Quick legal move check
-                        char originalCaptured = chessBoard->board[ty][tx].piece;
-                        bool originalLive = chessBoard->board[ty][tx].live;
-                        
-                        chessBoard->board[ty][tx] = chessBoard->board[y][x];
-                        chessBoard->board[y][x].piece = ' ';
-                        chessBoard->board[y][x].live = false;
-                        
-                        bool leavesKingInCheck = moveLeavesKingInCheck(chessBoard, maximizingPlayer ? 0 : 1);
-                        
-                        chessBoard->board[y][x] = chessBoard->board[ty][tx];
-                        chessBoard->board[ty][tx].piece = originalCaptured;
-                        chessBoard->board[ty][tx].live = originalLive;
-                        
-                        if (!leavesKingInCheck) {
-                            moves[moveCount++] = move;
-                            if (moveCount >= 200) break;
-                        }
-                    }
-                }
-                if (moveCount >= 200) break;
-            }
-            if (moveCount >= 200) break;
-        }
-        if (moveCount >= 200) break;
-    }
+    memmove(chessBoard->history->states, chessBoard->history->states + drop, keep * sizeof(UNDOSTATE));
+    chessBoard->historyCount = keep;
+}
+
+// Passes the turn, clearing any en passant target; undoNullMove puts it back from the record
+void makeNullMove(BOARD *chessBoard)
+{
+    pushUndoState(chessBoard, EMPTY);
     
-    // Order captures by MVV-LVA
-    orderMoves(chessBoard, moves, moveCount);
+    // Repetitions are not looked for across a null move
+    chessBoard->halfmoveClock = 0;
     
-    for (int i = 0; i < moveCount; i++) {
-        makeMove(chessBoard, moves[i]);
-        int score = quiescence(chessBoard, alpha, beta, !maximizingPlayer);
-        undoMove(chessBoard, moves[i]);
-        
-        if (maximizingPlayer) {
-            if (score >= beta) return beta;
-            if (score > alpha) alpha = score;
-        } else {
-            if (score <= alpha) return alpha;
-            if (score < beta) beta = score;
-        }
+    if (chessBoard->enPassantFile != -1) {
+        chessBoard->key ^= zobristEnPassant[chessBoard->enPassantFile];
+        chessBoard->enPassantFile = -1;
+        chessBoard->enPassantRank = -1;
     }
-    
-    return maximizingPlayer ? alpha : beta;
+    chessBoard->sideToMove ^= 1;
+    chessBoard->key ^= zobristBlackToMove;
 }
 
-int minimax(BOARD *chessBoard, int depth, int alpha, int beta, bool maximizingPlayer)
+void undoNullMove(BOARD *chessBoard)
 {
-    if (depth == 0) {
-        return quiescence(chessBoard, alpha, beta, maximizingPlayer);
-    }
-    
-    MOVE moves[200];
-    int moveCount;
-    generateMoves(chessBoard, moves, &moveCount, maximizingPlayer);
-    
-    if (moveCount == 0) {
-        if (isInCheck(chessBoard, maximizingPlayer)) {
-            return maximizingPlayer ? -INFINITY : INFINITY;
-        } else {
-            return 0;
-        }
+    popUndoState(chessBoard);
+}
+
+void generateMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite)
+{
+    generateLegalMoves(chessBoard, moves, moveCount, isWhite, GEN_ALL);
+}
+
+// Sizes the table to the largest power-of-two bucket count that fits in the given megabytes
+bool ttInit(int megabytes)
+{
+    U64 bytes = (U64)(megabytes > 0 ? megabytes : 1) * 1024 * 1024;
+    U64 count = 1;
+    while (count * 2 * sizeof(TTBUCKET) <= bytes) count *= 2;
+    
+    free(ttTable);
+    ttTable = aligned_alloc(64, count * sizeof(TTBUCKET));
+    if (ttTable == NULL) {
+        ttBucketCount = 0;
+        return false;
     }
-    
-    // Order moves for better alpha-beta pruning
-    orderMoves(chessBoard, moves, moveCount);
-    
-    if (maximizingPlayer) {
-        int maxEval = -INFINITY;
-        for (int i = 0; i < moveCount; i++) {
-            makeMove(chessBoard, moves[i]);
-            int eval = minimax(chessBoard, depth - 1, alpha, beta, false);
-            undoMove(chessBoard, moves[i]);
-            
-            maxEval = (eval > maxEval) ? eval : maxEval;
-            alpha = (alpha > eval) ? alpha : eval;
-            if (beta <= alpha) break; // Alpha-beta pruning
-        }
-        return maxEval;
-    } else {
-        int minEval = INFINITY;
-        for (int i = 0; i < moveCount; i++) {
-            makeMove(chessBoard, moves[i]);
-            int eval = minimax(chessBoard, depth - 1, alpha, beta, true);
-            undoMove(chessBoard, moves[i]);
-            
-            minEval = (eval < minEval) ? eval : minEval;
-            beta = (beta < eval) ? beta : eval;
-            if (beta <= alpha) break; // Alpha-beta pruning
+    memset(ttTable, 0, count * sizeof(TTBUCKET));
+    ttBucketCount = count;
+    ttGeneration = 0;
+    return true;
+}
+
+void ttClear(void)
+{
+    memset(ttTable, 0, ttBucketCount * sizeof(TTBUCKET));
+    ttGeneration = 0;
+}
+
+void ttNewSearch(void)
+{
+    ttGeneration = (ttGeneration + 1) & ((1 << TT_AGE_BITS) - 1);
+}
+
+// From/to squares and promotion type in 15 bits
+unsigned short packMove(MOVE move)
+{
+    int promotion = (move.promotionPiece != EMPTY) ? pieceType(move.promotionPiece) : 0;
+    return (unsigned short)(COORD_TO_SQUARE(move.from) | (COORD_TO_SQUARE(move.to) << 6) | (promotion << 12));
+}
+
+TTENTRY *ttProbe(U64 key)
+{
+    TTBUCKET *bucket = &ttTable[key & (ttBucketCount - 1)];
+    for (int i = 0; i < TT_BUCKET_ENTRIES; i++) {
+        if (bucket->entries[i].key == key && bucket->entries[i].boundAge != 0) {
+            return &bucket->entries[i];
         }
-        return minEval;
     }
+    return NULL;
 }
 
-void ai_playPiece(int *AI_SCORE, BOARD *chessBoard)
+// Lower is a better victim: entries from older searches first, then the shallowest
+static int ttReplaceScore(TTENTRY *entry)
 {
-    MOVE moves[200];
-    int moveCount;
-    generateMoves(chessBoard, moves, &moveCount, false);
-    
-    if (moveCount == 0) {
-        printf("AI has no legal moves!\n");
-        return;
-    }
+    int age = (ttGeneration - (entry->boundAge >> 2)) & ((1 << TT_AGE_BITS) - 1);
+    return entry->depth - 8 * age;
+}
+
+void ttStore(U64 key, int depth, int score, int bound, unsigned short move)
+{
+    TTBUCKET *bucket = &ttTable[key & (ttBucketCount - 1)];
+    TTENTRY *replace = &bucket->entries[0];
     
-    // Opening book for first few moves
-    if (chessBoard->moveCount <= 6) {
-        MOVE openingMove = getOpeningMove(chessBoard);
-        if (openingMove.from != -1) {
-            makeMove(chessBoard, openingMove);
-            *AI_SCORE = evaluateBoard(chessBoard);
-            
-            int fromX = openingMove.from % 10, fromY = openingMove.from / 10;
-            int toX = openingMove.to % 10, toY = openingMove.to / 10;
-            printf("AI plays: %c%d%c%d (opening book)\n", 
-                   'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
-            return;
+    for (int i = 0; i < TT_BUCKET_ENTRIES; i++) {
+        TTENTRY *entry = &bucket->entries[i];
+        if (entry->key == key || entry->boundAge == 0) {
+            replace = entry;
+            break;
         }
+        if (ttReplaceScore(entry) < ttReplaceScore(replace)) replace = entry;
     }
     
-    // Order moves for better tactical play
-    orderMoves(chessBoard, moves, moveCount);
-    
-    MOVE bestMove = moves[0];
-    int bestScore = -INFINITY;
-    
-    for (int i = 0; i < moveCount; i++) {
-        makeMove(chessBoard, moves[i]);
-        int score = minimax(chessBoard, MAX_DEPTH - 1, -INFINITY, INFINITY, true);
-        undoMove(chessBoard, moves[i]);
-        
-        if (score > bestScore) {
-            bestScore = score;
-            bestMove = moves[i];
-        }
+    // Same position: a deeper bound from this search is worth more than a shallow one
+    if (replace->key == key && replace->boundAge != 0 && bound != TT_EXACT &&
+        depth < replace->depth && (replace->boundAge >> 2) == ttGeneration) {
+        if (replace->move == NO_MOVE) replace->move = move;
+        return;
     }
     
-    makeMove(chessBoard, bestMove);
-    *AI_SCORE = bestScore;
-    
-    int fromX = bestMove.from % 10, fromY = bestMove.from / 10;
-    int toX = bestMove.to % 10, toY = bestMove.to / 10;
+    // Keep the old move when this search did not find a better one
+    if (move == NO_MOVE && replace->key == key) move = replace->move;
     
-    // Show what type of move was made
-    if (bestMove.capturedPiece != ' ') {
-        printf("AI plays: %c%d%c%d (captures %c)\n", 
-               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY, bestMove.capturedPiece);
-    } else if (bestMove.isCastling) {
-        printf("AI plays: %c%d%c%d (castling)\n", 
-               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
-    } else if (bestMove.promotionPiece != ' ') {
-        printf("AI plays: %c%d%c%d (promotes to %c)\n", 
-               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY, bestMove.promotionPiece);
-    } else {
-        printf("AI plays: %c%d%c%d\n", 
-               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
-    }
+    replace->key = key;
+    replace->score = score;
+    replace->move = move;
+    replace->depth = (signed char)depth;
+    replace->boundAge = (unsigned char)(bound | (ttGeneration << 2));
 }
 
-bool isInCheck(BOARD *chessBoard, bool isWhite)
+// score is the entry's score already converted back with scoreFromTT()
+static inline bool ttCutoff(TTENTRY *entry, int score, int alpha, int beta)
 {
-    return moveLeavesKingInCheck(chessBoard, isWhite ? 0 : 1);
+    int bound = entry->boundAge & 3;
+    return bound == TT_EXACT ||
+           (bound == TT_LOWER && score >= beta) ||
+           (bound == TT_UPPER && score <= alpha);
 }
 
-bool hasLegalMoves(BOARD *chessBoard, bool isWhite)
+// Mate scores count plies from the root; the table keeps them counted from the stored node
+// so they stay right when the position comes up again at another ply
+static inline int scoreToTT(int score, int ply)
 {
-    MOVE moves[200];
-    int moveCount;
-    generateMoves(chessBoard, moves, &moveCount, isWhite);
-    return moveCount > 0;
+    if (score >= SCORE_MATE_BOUND) return score + ply;
+    if (score <= -SCORE_MATE_BOUND) return score - ply;
+    return score;
 }
 
-int gameCheck(BOARD *chessBoard)
+static inline int scoreFromTT(int score, int ply)
 {
-    bool whiteHasMoves = hasLegalMoves(chessBoard, true);
-    bool blackHasMoves = hasLegalMoves(chessBoard, false);
-    bool whiteInCheck = isInCheck(chessBoard, true);
-    bool blackInCheck = isInCheck(chessBoard, false);
-    
-    if (!whiteHasMoves) {
-        if (whiteInCheck) {
-            printf("Checkmate! Black wins!\n");
-            return 1; // checkmate
-        } else {
-            printf("Stalemate!\n");
-            return 2; // stalemate
-        }
-    }
-    
-    if (!blackHasMoves) {
-        if (blackInCheck) {
-            printf("Checkmate! White wins!\n");
-            return 1; // checkmate
-        } else {
-            printf("Stalemate!\n");
-            return 2; // stalemate
-        }
-    }
-    
-    return 0; // game continues
+    if (score >= SCORE_MATE_BOUND) return score - ply;
+    if (score <= -SCORE_MATE_BOUND) return score + ply;
+    return score;
 }
 
-bool moveLeavesKingInCheck(BOARD *chessBoard, int color)    // 0 for white, 1 for black
+// Classifies a search result against the window it was searched with
+static inline int ttBound(int score, int alpha, int beta)
 {
-    /*
-    **********************************
-    TODO: implement this POS fucntion
-    **********************************
-
-        --return true if the move leaves the king in check
+    if (score <= alpha) return TT_UPPER;
+    if (score >= beta) return TT_LOWER;
+    return TT_EXACT;
+}
 
-    */
-    if (color == 0)
-    {
-        int kingX = chessBoard->whiteKing.x, compX;
-        int kingY = chessBoard->whiteKing.y, compY;
+// Milliseconds from a clock that never jumps backwards
+static long long currentTimeMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-        // checks up
-        if (kingY - 1 >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX].piece == 'k')
-            {
-                return true;
-            }
-            compY = kingY - 1;
-            while(compY >= 0)
-            {
-                if ((chessBoard->board[compY][kingX].piece >= 65 && chessBoard->board[compY][kingX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][kingX].piece == 'r' ||
-                            chessBoard->board[compY][kingX].piece == 'q'
-                )
-                {
-                    return true;
-                }
-                compY--;
-            }
-        }
+void startSearch(SEARCHLIMITS *limits)
+{
+    searchStartTime = currentTimeMs();
+    searchNodes = 0;
+    memset(&pruneStats, 0, sizeof(pruneStats));
+    searchNodeLimit = limits->nodes;
+    stopSearch = false;
+    searchCanStop = false;
+    previousPvLength = 0;
+    
+    // Either a fixed time per move or a share of the remaining clock
+    int budget = 0;
+    if (limits->moveTime > 0) {
+        budget = limits->moveTime;
+    } else if (limits->timeLeft > 0) {
+        budget = limits->timeLeft / CLOCK_MOVES_TO_GO + limits->increment * 3 / 4;
+        if (budget > limits->timeLeft / 4) budget = limits->timeLeft / 4;
+        if (budget < 1) budget = 1;
+    }
+    
+    // An iteration usually takes longer than all the previous ones together,
+    // so one started after half the budget would most likely be thrown away
+    searchSoftLimit = budget ? searchStartTime + budget / 2 : 0;
+    searchHardLimit = budget ? searchStartTime + budget : 0;
+}
 
-        // checks down
+// Called every NODE_CHECK_INTERVAL nodes; once set, stopSearch unwinds the whole search
+void checkSearchLimits(void)
+{
+    if (!searchCanStop) return;
+    
+    if ((searchNodeLimit > 0 && searchNodes >= searchNodeLimit) ||
+        (searchHardLimit > 0 && currentTimeMs() >= searchHardLimit)) {
+        stopSearch = true;
+    }
+}
 
-        if (kingY + 1 <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX].piece == 'k')
-            {
-                return true;
-            }
-            compY = kingY + 1;
-            while (compY <= 7)
-            {
-                if ((chessBoard->board[compY][kingX].piece >= 65 && chessBoard->board[compY][kingX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][kingX].piece == 'r' ||
-                            chessBoard->board[compY][kingX].piece == 'q'
-                )
-                {
-                    return true;
-                }
-                compY++;
+// Deeper nodes and later moves are reduced more; both grow logarithmically
+void initReductions(void)
+{
+    for (int depth = 0; depth < MAX_DEPTH; depth++) {
+        for (int index = 0; index < MAX_MOVES; index++) {
+            if (depth == 0 || index == 0) {
+                lmrReductions[depth][index] = 0;
+                continue;
             }
+            lmrReductions[depth][index] = (int)(LMR_BASE + log(depth) * log(index) / LMR_DIVISOR);
         }
+    }
+}
 
-        // checks right
-
-        if (kingX + 1 <= 7)
-        {
-            if (chessBoard->board[kingY][kingX + 1].piece == 'k')
-            {
-                return true;
-            }
-            compX = kingX + 1;
-            while (compX <= 7)
-            {
-                if ((chessBoard->board[kingY][compX].piece >= 65 && chessBoard->board[kingY][compX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[kingY][compX].piece == 'r' ||
-                            chessBoard->board[kingY][compX].piece == 'q'
-                )
-                {
-                    return true;
-                }
-                compX++;
-            }
-        }
+// Moves the score towards +/- HISTORY_MAX, by less the closer it already is
+static inline void addHistoryBonus(int *entry, int bonus)
+{
+    *entry += bonus - *entry * abs(bonus) / HISTORY_MAX;
+}
 
-        // checks left
+// Butterfly history plus the continuation histories of the moves one and two plies back
+static int quietHistoryScore(SEARCHSTACK *stack, int color, int piece, int from, int to)
+{
+    int score = historyTable[color][from][to];
+    if (stack[-1].movedPiece >= 0) score += continuationHistory[0][stack[-1].movedPiece][stack[-1].toSquare][piece][to];
+    if (stack[-2].movedPiece >= 0) score += continuationHistory[1][stack[-2].movedPiece][stack[-2].toSquare][piece][to];
+    return score;
+}
 
-        if (kingX - 1 >= 0)
-        {
-            if (chessBoard->board[kingY][kingX - 1].piece == 'k')
-            {
-                return true;
-            }
-            compX = kingX - 1;
-            while (compX >= 0)
-            {
-                if ((chessBoard->board[kingY][compX].piece >= 65 && chessBoard->board[kingY][compX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[kingY][compX].piece == 'r' ||
-                            chessBoard->board[kingY][compX].piece == 'q'
-                )
-                {
-                    return true;
-                }
-                compX--;
-            }
-        }
+static void addQuietBonus(BOARD *chessBoard, SEARCHSTACK *stack, unsigned short move, int bonus)
+{
+    int from = move & 63, to = (move >> 6) & 63;
+    int piece = chessBoard->board[from / 8][from % 8];
+    int index = pieceIndex(piece);
+    
+    addHistoryBonus(&historyTable[pieceColor(piece)][from][to], bonus);
+    if (stack[-1].movedPiece >= 0) addHistoryBonus(&continuationHistory[0][stack[-1].movedPiece][stack[-1].toSquare][index][to], bonus);
+    if (stack[-2].movedPiece >= 0) addHistoryBonus(&continuationHistory[1][stack[-2].movedPiece][stack[-2].toSquare][index][to], bonus);
+}
 
-        // forward right diagonal
+// Rewards the quiet move that failed high and penalises the quiet moves tried before it
+static void updateQuietHistory(BOARD *chessBoard, SEARCHSTACK *stack, unsigned short move, unsigned short quietsTried[], int quietCount, int depth)
+{
+    int bonus = depth * depth < HISTORY_MAX / 4 ? depth * depth : HISTORY_MAX / 4;
+    
+    if (stack->killers[0] != move) {
+        stack->killers[1] = stack->killers[0];
+        stack->killers[0] = move;
+    }
+    if (stack[-1].movedPiece >= 0) counterMoves[stack[-1].movedPiece][stack[-1].toSquare] = move;
+    
+    addQuietBonus(chessBoard, stack, move, bonus);
+    for (int i = 0; i < quietCount; i++) {
+        addQuietBonus(chessBoard, stack, quietsTried[i], -bonus);
+    }
+}
 
-        if ((kingX + 1) <= 7 && (kingY - 1) >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX + 1].piece == 'k' || chessBoard->board[kingY - 1][kingX + 1].piece == 'p')
-            {
-                return true;
-            }
-            compX = kingX + 1, compY = kingY - 1;
-            while (compX <= 7 && compY >= 0)
-            {
-                if ((chessBoard->board[compY][compX].piece >= 65 && chessBoard->board[compY][compX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'q' ||
-                            chessBoard->board[compY][compX].piece == 'b'    
-                )
-                {
-                    return true;
-                }
-                compX++, compY--;
-            }
-        }
+// The search plays its moves through these. Built with -DCOPY_MAKE, the child of a node at ply
+// is searched on a copy of the position kept in searchStack[ply + 1] and taking the move back
+// costs nothing; otherwise the move is made on the board itself and undone from the undo record
+static inline BOARD *searchMakeMove(BOARD *chessBoard, int ply, MOVE move)
+{
+#ifdef COPY_MAKE
+    searchStack[ply + 1].position = *chessBoard;
+    chessBoard = &searchStack[ply + 1].position;
+#else
+    (void)ply;
+#endif
+    makeMove(chessBoard, move);
+    return chessBoard;
+}
 
-        // forward left diagonal
+static inline void searchUndoMove(BOARD *chessBoard, MOVE move)
+{
+#ifndef COPY_MAKE
+    undoMove(chessBoard, move);
+#else
+    (void)chessBoard, (void)move;
+#endif
+}
 
-        if ((kingX - 1) >= 0 && (kingY - 1) >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX - 1].piece == 'k' || chessBoard->board[kingY - 1][kingX - 1].piece == 'p')
-            {
-                return true;
-            }
-            compX = kingX - 1, compY = kingY - 1;
-            while (compX >= 0 && compY >= 0)
-            {
-                if ((chessBoard->board[compY][compX].piece >= 65 && chessBoard->board[compY][compX].piece <= 90))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'q' ||
-                            chessBoard->board[compY][compX].piece == 'b'
-                )
-                {
-                    return true;
-                }
-                compX--, compY--;
-            }
-        }
+static inline BOARD *searchMakeNullMove(BOARD *chessBoard, int ply)
+{
+#ifdef COPY_MAKE
+    searchStack[ply + 1].position = *chessBoard;
+    chessBoard = &searchStack[ply + 1].position;
+#else
+    (void)ply;
+#endif
+    makeNullMove(chessBoard);
+    return chessBoard;
+}
 
-        //backward right diagonal
+static inline void searchUndoNullMove(BOARD *chessBoard)
+{
+#ifndef COPY_MAKE
+    undoNullMove(chessBoard);
+#else
+    (void)chessBoard;
+#endif
+}
 
-        if ((kingX + 1) <= 7 && (kingY + 1) <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX + 1].piece == 'k')
-            {
-                return true;
-            }
-            compX = kingX + 1, compY = kingY + 1;
-            while (compX <= 7 && compY <= 7)
-            {
-                if (chessBoard->board[compY][compX].piece >= 65 && chessBoard->board[compY][compX].piece <= 90)
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'q' ||
-                            chessBoard->board[compY][compX].piece == 'b'
-                )
-                {
-                    return true;
-                }
-                compX++, compY++;
-            }
+// Clears the per-ply state and halves the histories so the last move's knowledge fades
+static void resetSearchStack(void)
+{
+    memset(searchStackEntries, 0, sizeof(searchStackEntries));
+    for (int i = 0; i < MAX_PLY + 2; i++) searchStackEntries[i].movedPiece = -1;
+    
+    for (int color = 0; color < 2; color++) {
+        for (int from = 0; from < 64; from++) {
+            for (int to = 0; to < 64; to++) historyTable[color][from][to] /= 2;
         }
+    }
+    int *continuation = &continuationHistory[0][0][0][0][0];
+    for (size_t i = 0; i < sizeof(continuationHistory) / sizeof(int); i++) continuation[i] /= 2;
+}
 
-        // check for knight moves
-
-        int knightMoves[8][2] = {
-            {-2, -1}, {-2, +1}, {-1, -2}, {-1, +2},
-            {+1, -2}, {+1, +2}, {+2, -1}, {+2, +1}
-        };
-
-        for (int i = 0; i < 8; i++) {
-            int nx = kingX + knightMoves[i][1];
-            int ny = kingY + knightMoves[i][0];
+// Makes move followed by the child's line the best line from this ply
+static void updatePv(int ply, MOVE move)
+{
+    pvTable[ply][ply] = move;
+    for (int next = ply + 1; next < pvLength[ply + 1]; next++) {
+        pvTable[ply][next] = pvTable[ply + 1][next];
+    }
+    pvLength[ply] = pvLength[ply + 1];
+}
 
-            if (nx >= 0 && nx <= 7 && ny >= 0 && ny <= 7) {
-                if (chessBoard->board[ny][nx].piece == 'n') {
-                    return true;
-                }
+// Fail-soft search below the horizon, scored for the side to move. In check every evasion is
+// searched with no stand pat; otherwise captures and queen promotions, plus quiet checks on the
+// first ply. depth counts down from 0 and stops at -QS_MAX_PLY (or MAX_PLY), returning the eval
+int quiescence(BOARD *chessBoard, int depth, int ply, int alpha, int beta)
+{
+    if ((++searchNodes & (NODE_CHECK_INTERVAL - 1)) == 0) checkSearchLimits();
+    if (stopSearch) return 0;
+    
+    // Any stored result can cut here, quiescence entries have depth 0
+    unsigned short hashMove = NO_MOVE;
+    TTENTRY *entry = ttProbe(chessBoard->key);
+    if (entry) {
+        hashMove = entry->move;
+        int ttScore = scoreFromTT(entry->score, ply);
+        if (ttCutoff(entry, ttScore, alpha, beta)) return ttScore;
+    }
+    
+    bool isWhite = chessBoard->sideToMove == WHITE;
+    bool inCheck = isInCheck(chessBoard, isWhite);
+    if (depth <= -QS_MAX_PLY || ply >= MAX_PLY - 1) return evaluateBoard(chessBoard);
+    
+    MOVE moves[MAX_MOVES];
+    int moveCount;
+    int originalAlpha = alpha;
+    int bestScore = -SCORE_INFINITY;
+    int standPat = -SCORE_INFINITY;
+    
+    if (inCheck) {
+        // No standing pat in check: every evasion is searched, and having none is mate
+        generateLegalMoves(chessBoard, moves, &moveCount, isWhite, GEN_ALL);
+        if (moveCount == 0) return -SCORE_MATE + ply;
+    } else {
+        // Standing pat: the side to move is assumed to have at least one move as good as doing nothing
+        standPat = evaluateBoard(chessBoard);
+        if (standPat >= beta) return standPat;
+        if (standPat > alpha) alpha = standPat;
+        bestScore = standPat;
+        
+        generateLegalMoves(chessBoard, moves, &moveCount, isWhite, GEN_TACTICAL);
+        
+        // Right at the horizon a quiet check can still be the whole point of the line
+        if (depth == 0) {
+            MOVE quiets[MAX_MOVES];
+            int quietCount;
+            generateLegalMoves(chessBoard, quiets, &quietCount, isWhite, GEN_QUIETS);
+            for (int i = 0; i < quietCount; i++) {
+                if (quiets[i].promotionPiece == EMPTY && givesCheck(chessBoard, quiets[i])) moves[moveCount++] = quiets[i];
             }
         }
-
-        //backward left diagonal
-
-        if ((kingX - 1) >= 0 && (kingY + 1) <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX - 1].piece == 'k')
-            {
-                return true;
+    }
+    
+    // Winning and even captures first by MVV-LVA
+    orderMoves(chessBoard, moves, moveCount, hashMove, NULL);
+    
+    unsigned short bestMove = NO_MOVE;
+    for (int i = 0; i < moveCount; i++) {
+        bool isCapture = moves[i].capturedPiece != EMPTY || moves[i].promotionPiece != EMPTY;
+        
+        // Delta pruning: even winning the victim outright would leave us below alpha
+        int victimValue = getPieceValue(moves[i].capturedPiece);
+        if (moves[i].promotionPiece != EMPTY) victimValue += getPieceValue(moves[i].promotionPiece) - VALUE_PAWN;
+        int optimistic = standPat + victimValue * DELTA_PIECE_WEIGHT + DELTA_MARGIN;
+        if (!inCheck && isCapture && optimistic <= alpha) {
+            if (optimistic > bestScore) bestScore = optimistic;
+            continue;
+        }
+        
+        // A capture or check that loses material to the recaptures cannot raise the stand-pat score
+        if (!inCheck && moves[i].score < ORDER_CAPTURE / 2 && staticExchange(chessBoard, moves[i]) < 0) continue;
+        
+        BOARD *child = searchMakeMove(chessBoard, ply, moves[i]);
+        int score = -quiescence(child, depth - 1, ply + 1, -beta, -alpha);
+        searchUndoMove(chessBoard, moves[i]);
+        if (stopSearch) return 0;
+        
+        if (score > bestScore) {
+            bestScore = score;
+            if (score > alpha) {
+                alpha = score;
+                bestMove = packMove(moves[i]);
             }
-            compX = kingX - 1, compY = kingY + 1;
-            while (compX >= 0 && compY <= 7)
-            {
-                if (chessBoard->board[compY][compX].piece >= 65 && chessBoard->board[compY][compX].piece <= 90)
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'q' ||
-                            chessBoard->board[compY][compX].piece == 'b'
-                )
-                {
-                    return true;
-                }
-                compX--, compY++;
+            if (score >= beta) {
+                ttStore(chessBoard->key, 0, scoreToTT(score, ply), TT_LOWER, packMove(moves[i]));
+                return score;
             }
         }
-
-        // if the functino does not return true
-        return false;
     }
-    else
-    {
-        int kingX = chessBoard->blackKing.x, compX;
-        int kingY = chessBoard->blackKing.y, compY;
+    
+    ttStore(chessBoard->key, 0, scoreToTT(bestScore, ply), ttBound(bestScore, originalAlpha, beta), bestMove);
+    return bestScore;
+}
 
-        // checks up
-        if (kingY - 1 >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX].piece == 'K')
-            {
-                return true;
-            }
-            compY = kingY - 1;
-            while(compY >= 0)
-            {
-                if ((chessBoard->board[compY][kingX].piece >= 97 && chessBoard->board[compY][kingX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][kingX].piece == 'R' ||
-                            chessBoard->board[compY][kingX].piece == 'Q'
-                )
-                {
-                    return true;
-                }
-                compY--;
-            }
+// Fail-soft negamax with principal variation search; scores are from the side to move's point of view
+int minimax(BOARD *chessBoard, int depth, int ply, int alpha, int beta)
+{
+    // Only the first move of a node on the previous PV continues it
+    bool onPv = followPv;
+    followPv = false;
+    pvLength[ply] = ply;
+    
+    // Tested before the horizon so a cycle ending at the frontier is a draw, never at the root
+    if (ply > 0 && (chessBoard->halfmoveClock >= FIFTY_MOVE_PLIES || isSearchRepetition(chessBoard, ply))) return 0;
+    
+    if (depth == 0 || ply >= MAX_PLY - 1) {
+        return quiescence(chessBoard, 0, ply, alpha, beta);
+    }
+    
+    if ((++searchNodes & (NODE_CHECK_INTERVAL - 1)) == 0) checkSearchLimits();
+    if (stopSearch) return 0;
+    
+    // Mate-distance pruning: no line from here can beat being mated right now or mating next
+    // move, so once a shorter mate is known elsewhere the window can shrink to nothing
+    if (alpha < -SCORE_MATE + ply) alpha = -SCORE_MATE + ply;
+    if (beta > SCORE_MATE - ply - 1) beta = SCORE_MATE - ply - 1;
+    if (alpha >= beta) return alpha;
+    
+    // The singular-extension search looks at this position minus one move, so the table
+    // neither answers for it nor stores its result
+    unsigned short excludedMove = searchStack[ply].excludedMove;
+    unsigned short hashMove = NO_MOVE;
+    TTENTRY *entry = (excludedMove == NO_MOVE) ? ttProbe(chessBoard->key) : NULL;
+    int ttScore = 0, ttDepth = 0, ttBoundType = 0;
+    if (entry) {
+        hashMove = entry->move;
+        ttScore = scoreFromTT(entry->score, ply);
+        if (entry->depth >= depth && ttCutoff(entry, ttScore, alpha, beta)) return ttScore;
+        ttDepth = entry->depth;
+        ttBoundType = entry->boundAge & 3;
+    }
+    unsigned short ttMove = hashMove;
+    
+    bool isWhite = chessBoard->sideToMove == WHITE;
+    bool inCheck = isInCheck(chessBoard, isWhite);
+    bool isPvNode = beta - alpha > 1;
+    searchStack[ply].nullMove = false;
+    int staticEval = inCheck ? -SCORE_INFINITY : evaluateBoard(chessBoard);
+    
+    // Reverse futility: this far above beta, one ply of quiet moves will not bring the score back down
+    if (!isPvNode && !inCheck && depth <= REVERSE_FUTILITY_DEPTH && abs(beta) < SCORE_MATE_BOUND &&
+        staticEval - REVERSE_FUTILITY_MARGIN * depth >= beta) {
+        pruneStats.reverseFutility++;
+        return staticEval;
+    }
+    
+    // Razoring: this far below alpha only a tactic can help, and quiescence is enough to look for one
+    if (!isPvNode && !inCheck && depth <= RAZOR_DEPTH && staticEval + RAZOR_MARGIN * depth < alpha) {
+        int score = quiescence(chessBoard, 0, ply, alpha, beta);
+        if (stopSearch) return 0;
+        if (depth == 1 || score < alpha) {
+            pruneStats.razoring++;
+            return score;
         }
-
-        // checks down
-        if (kingY + 1 <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX].piece == 'K')
-            {
-                return true;
-            }
-            compY = kingY + 1;
-            while (compY <= 7)
-            {
-                if ((chessBoard->board[compY][kingX].piece >= 97 && chessBoard->board[compY][kingX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][kingX].piece == 'R' ||
-                            chessBoard->board[compY][kingX].piece == 'Q'
-                )
-                {
-                    return true;
-                }
-                compY++;
+    }
+    
+    // Null move: if passing the turn still beats beta, a real move almost certainly does too.
+    // Not in check, not twice in a row, and not with only pawns left, where passing could be
+    // the one thing the side to move cannot afford (zugzwang)
+    int side = chessBoard->sideToMove;
+    U64 pieces = chessBoard->colorBB[side] & ~chessBoard->pieceBB[side][PAWN] & ~chessBoard->pieceBB[side][KING];
+    if (!isPvNode && !inCheck && depth >= NULL_MOVE_MIN_DEPTH && pieces && excludedMove == NO_MOVE &&
+        !(ply > 0 && searchStack[ply - 1].nullMove) && !searchStack[ply].skipNullMove &&
+        staticEval >= beta) {
+        int reduction = NULL_MOVE_REDUCTION + depth / 6;
+        int nullDepth = (depth - 1 - reduction > 0) ? depth - 1 - reduction : 0;
+        
+        searchStack[ply].nullMove = true;
+        searchStack[ply].movedPiece = -1;
+        BOARD *child = searchMakeNullMove(chessBoard, ply);
+        int score = -minimax(child, nullDepth, ply + 1, -beta, -beta + 1);
+        searchUndoNullMove(chessBoard);
+        searchStack[ply].nullMove = false;
+        if (stopSearch) return 0;
+        
+        if (score >= beta) {
+            // A null-move mate proves nothing about the real moves
+            if (score >= SCORE_MATE_BOUND) score = beta;
+            
+            // Zugzwang gets likelier as material comes off, so check the cutoff with our own move
+            if (NULL_MOVE_VERIFICATION && countMaterial(chessBoard) <= ENDGAME_MATERIAL) {
+                searchStack[ply].skipNullMove = true;
+                int verified = minimax(chessBoard, nullDepth, ply, beta - 1, beta);
+                searchStack[ply].skipNullMove = false;
+                if (stopSearch) return 0;
+                if (verified >= beta) return score;
+            } else {
+                return score;
             }
         }
-
-        // checks right
-        if (kingX + 1 <= 7)
-        {
-            if (chessBoard->board[kingY][kingX + 1].piece == 'K')
-            {
-                return true;
-            }
-            compX = kingX + 1;
-            while (compX <= 7)
-            {
-                if ((chessBoard->board[kingY][compX].piece >= 97 && chessBoard->board[kingY][compX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[kingY][compX].piece == 'R' ||
-                            chessBoard->board[kingY][compX].piece == 'Q'
-                )
-                {
-                    return true;
-                }
-                compX++;
+    }
+    
+    MOVE moves[MAX_MOVES];
+    int moveCount;
+    generateMoves(chessBoard, moves, &moveCount, isWhite);
+    
+    if (moveCount == 0) {
+        // Checkmated or stalemated
+        return inCheck ? -SCORE_MATE + ply : 0;
+    }
+    
+    // The previous iteration's PV move outranks the hash move
+    if (onPv && ply < previousPvLength) {
+        unsigned short pvMove = packMove(previousPv[ply]);
+        for (int i = 0; i < moveCount; i++) {
+            if (packMove(moves[i]) == pvMove) {
+                hashMove = pvMove;
+                followPv = true;
+                break;
             }
         }
-
-        // checks left
-        if (kingX - 1 >= 0)
-        {
-            if (chessBoard->board[kingY][kingX - 1].piece == 'K')
-            {
-                return true;
-            }
-            compX = kingX - 1;
-            while (compX >= 0)
-            {
-                if ((chessBoard->board[kingY][compX].piece >= 97 && chessBoard->board[kingY][compX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[kingY][compX].piece == 'R' ||
-                            chessBoard->board[kingY][compX].piece == 'Q'
-                )
-                {
-                    return true;
-                }
-                compX--;
+    }
+    
+    // Order moves for better alpha-beta pruning
+    orderMoves(chessBoard, moves, moveCount, hashMove, &searchStack[ply]);
+    
+    int originalAlpha = alpha;
+    int bestScore = -SCORE_INFINITY;
+    unsigned short bestMove = NO_MOVE;
+    unsigned short quietsTried[MAX_MOVES];
+    int quietCount = 0;
+    
+    // Singular extension: if every move but the hash move fails well below its score in a
+    // shallower search, the hash move is the only one holding the position and gets a ply more
+    bool singular = false;
+    if (depth >= SINGULAR_MIN_DEPTH && ply > 0 && ttMove != NO_MOVE && ttBoundType != TT_UPPER &&
+        ttDepth >= depth - SINGULAR_DEPTH_MARGIN && abs(ttScore) < SCORE_MATE_BOUND) {
+        int singularBeta = ttScore - SINGULAR_MARGIN * depth;
+        
+        // The exclusion search is off the PV; the flag set above belongs to the real first child
+        bool pvChild = followPv;
+        followPv = false;
+        searchStack[ply].excludedMove = ttMove;
+        int score = minimax(chessBoard, (depth - 1) / 2, ply, singularBeta - 1, singularBeta);
+        searchStack[ply].excludedMove = NO_MOVE;
+        followPv = pvChild;
+        if (stopSearch) return 0;
+        singular = score < singularBeta;
+        pvLength[ply] = ply;
+    }
+    
+    // Futility: near the horizon a quiet move cannot make up this much, unless it gives check
+    int futilityValue = staticEval + FUTILITY_MARGIN * depth;
+    bool futile = !isPvNode && !inCheck && depth <= FUTILITY_DEPTH && futilityValue <= alpha;
+    
+    for (int i = 0; i < moveCount; i++) {
+        unsigned short packed = packMove(moves[i]);
+        if (packed == excludedMove) continue;
+        
+        bool isQuiet = moves[i].capturedPiece == EMPTY && moves[i].promotionPiece == EMPTY && !moves[i].isCastling;
+        bool isCheck = givesCheck(chessBoard, moves[i]);
+        if (futile && isQuiet && i > 0 && !isCheck) {
+            pruneStats.futility++;
+            if (futilityValue > bestScore) bestScore = futilityValue;
+            continue;
+        }
+        int piece = pieceIndex(moves[i].movedPiece);
+        int fromSquare = COORD_TO_SQUARE(moves[i].from), toSquare = COORD_TO_SQUARE(moves[i].to);
+        int moveHistory = isQuiet ? quietHistoryScore(&searchStack[ply], side, piece, fromSquare, toSquare) : 0;
+        
+        // Late in a well-ordered list, or with a history of failing, a quiet move at a shallow
+        // non-PV node is not worth its nodes; killers, counter moves and checks are always searched
+        if (!isPvNode && !inCheck && isQuiet && i > 0 && depth <= LATE_MOVE_DEPTH && moves[i].score < ORDER_COUNTER_MOVE) {
+            bool lateMove = i >= LATE_MOVE_BASE + depth * depth;
+            bool badHistory = depth <= HISTORY_PRUNING_DEPTH && moveHistory < -HISTORY_PRUNING_MARGIN * depth;
+            if ((lateMove || badHistory) && !isCheck) {
+                if (badHistory) pruneStats.history++; else pruneStats.lateMove++;
+                continue;
             }
         }
-
-        // forward right diagonal (up-right for black)
-        if ((kingX + 1) <= 7 && (kingY - 1) >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX + 1].piece == 'K')
-            {
-                return true;
+        
+        // Checks are extended so forcing lines are not cut off at the horizon, but only checks
+        // that do not lose material: a line of sacrificial checks would otherwise never end
+        bool extendCheck = isCheck && staticExchange(chessBoard, moves[i]) >= 0;
+        int extension = (extendCheck || (singular && packed == ttMove)) ? 1 : 0;
+        int newDepth = depth - 1 + extension;
+        
+        searchStack[ply].movedPiece = piece;
+        searchStack[ply].toSquare = toSquare;
+        BOARD *child = searchMakeMove(chessBoard, ply, moves[i]);
+        int score;
+        if (i == 0) {
+            score = -minimax(child, newDepth, ply + 1, -beta, -alpha);
+        } else {
+            // Late quiet moves rarely turn out best once orderMoves has ranked them, so they are
+            // searched shallower first; checks and moves out of check are left alone
+            int reduction = 0;
+            if (depth >= LMR_MIN_DEPTH && i >= LMR_MIN_MOVE_INDEX && isQuiet && !inCheck && !isCheck) {
+                reduction = lmrReductions[depth < MAX_DEPTH ? depth : MAX_DEPTH - 1][i];
+                if (isPvNode) reduction--;
+                reduction -= moveHistory / LMR_HISTORY_DIVISOR;    // moves that kept working elsewhere get more depth
+                if (reduction < 0) reduction = 0;
+                if (reduction > depth - 2) reduction = depth - 2;
             }
-            compX = kingX + 1, compY = kingY - 1;
-            while (compX <= 7 && compY >= 0)
-            {
-                if ((chessBoard->board[compY][compX].piece >= 97 && chessBoard->board[compY][compX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'Q' ||
-                            chessBoard->board[compY][compX].piece == 'B'    
-                )
-                {
-                    return true;
-                }
-                compX++, compY--;
+            
+            // Later moves only need to be proven worse than the best so far; re-search the ones that are not
+            score = -minimax(child, newDepth - reduction, ply + 1, -alpha - 1, -alpha);
+            if (reduction > 0 && score > alpha) {
+                score = -minimax(child, newDepth, ply + 1, -alpha - 1, -alpha);
+            }
+            if (score > alpha && score < beta) {
+                score = -minimax(child, newDepth, ply + 1, -beta, -alpha);
             }
         }
-
-        // forward left diagonal (up-left for black)
-        if ((kingX - 1) >= 0 && (kingY - 1) >= 0)
-        {
-            if (chessBoard->board[kingY - 1][kingX - 1].piece == 'K')
-            {
-                return true;
+        searchUndoMove(chessBoard, moves[i]);
+        if (stopSearch) return 0;
+        
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove = packed;
+            if (score > alpha) {
+                alpha = score;
+                updatePv(ply, moves[i]);
             }
-            compX = kingX - 1, compY = kingY - 1;
-            while (compX >= 0 && compY >= 0)
-            {
-                if ((chessBoard->board[compY][compX].piece >= 97 && chessBoard->board[compY][compX].piece <= 122))
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'Q' ||
-                            chessBoard->board[compY][compX].piece == 'B'
-                )
-                {
-                    return true;
-                }
-                compX--, compY--;
+            if (alpha >= beta) {
+                // Alpha-beta pruning; a quiet refutation is worth trying early elsewhere
+                if (isQuiet) updateQuietHistory(chessBoard, &searchStack[ply], bestMove, quietsTried, quietCount, depth);
+                break;
             }
         }
+        if (isQuiet) quietsTried[quietCount++] = packed;
+    }
+    
+    if (excludedMove == NO_MOVE) ttStore(chessBoard->key, depth, scoreToTT(bestScore, ply), ttBound(bestScore, originalAlpha, beta), bestMove);
+    return bestScore;
+}
 
-        //backward right diagonal (down-right for black)
-        if ((kingX + 1) <= 7 && (kingY + 1) <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX + 1].piece == 'K' || chessBoard->board[kingY + 1][kingX + 1].piece == 'P')
-            {
-                return true;
-            }
-            compX = kingX + 1, compY = kingY + 1;
-            while (compX <= 7 && compY <= 7)
-            {
-                if (chessBoard->board[compY][compX].piece >= 97 && chessBoard->board[compY][compX].piece <= 122)
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'Q' ||
-                            chessBoard->board[compY][compX].piece == 'B'
-                )
-                {
-                    return true;
-                }
-                compX++, compY++;
+// One iteration over the AI's root moves inside [alpha, beta]; the best line ends up in pvTable[0]
+static int searchRoot(BOARD *chessBoard, MOVE moves[], int moveCount, int depth, int alpha, int beta)
+{
+    int bestScore = -SCORE_INFINITY;
+    pvLength[0] = 0;
+    
+    for (int i = 0; i < moveCount; i++) {
+        // Moves were ordered with the previous best first, so only move 0 can continue the old PV
+        followPv = (i == 0 && previousPvLength > 1 && packMove(moves[0]) == packMove(previousPv[0]));
+        
+        searchStack[0].movedPiece = pieceIndex(moves[i].movedPiece);
+        searchStack[0].toSquare = COORD_TO_SQUARE(moves[i].to);
+        BOARD *child = searchMakeMove(chessBoard, 0, moves[i]);
+        int score;
+        if (i == 0) {
+            score = -minimax(child, depth - 1, 1, -beta, -alpha);
+        } else {
+            score = -minimax(child, depth - 1, 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) {
+                score = -minimax(child, depth - 1, 1, -beta, -alpha);
             }
         }
+        searchUndoMove(chessBoard, moves[i]);
+        if (stopSearch) break;
+        
+        if (score > bestScore) bestScore = score;
+        if (score > alpha) {
+            alpha = score;
+            updatePv(0, moves[i]);
+        }
+        if (alpha >= beta) break;
+    }
+    
+    return bestScore;
+}
 
-        // check for knight moves
-        int knightMoves[8][2] = {
-            {-2, -1}, {-2, +1}, {-1, -2}, {-1, +2},
-            {+1, -2}, {+1, +2}, {+2, -1}, {+2, +1}
-        };
-
-        for (int i = 0; i < 8; i++) {
-            int nx = kingX + knightMoves[i][1];
-            int ny = kingY + knightMoves[i][0];
-
-            if (nx >= 0 && nx <= 7 && ny >= 0 && ny <= 7) {
-                if (chessBoard->board[ny][nx].piece == 'N') {
-                    return true;
-                }
-            }
+void ai_playPiece(int *AI_SCORE, BOARD *chessBoard)
+{
+    MOVE moves[MAX_MOVES];
+    int moveCount;
+    generateMoves(chessBoard, moves, &moveCount, false);
+    
+    if (moveCount == 0) {
+        printf("AI has no legal moves!\n");
+        return;
+    }
+    
+    // Entries from earlier moves stay usable, they are just first in line for replacement
+    ttNewSearch();
+    
+    // Opening book for first few moves
+    if (chessBoard->moveCount <= 6) {
+        MOVE openingMove = getOpeningMove(chessBoard);
+        if (openingMove.from != -1) {
+            makeMove(chessBoard, openingMove);
+            *AI_SCORE = -evaluateBoard(chessBoard);
+            
+            int fromX = openingMove.from % 10, fromY = openingMove.from / 10;
+            int toX = openingMove.to % 10, toY = openingMove.to / 10;
+            printf("AI plays: %c%d%c%d (opening book)\n", 
+                   'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
+            return;
         }
+    }
+    
+    int bestScore;
+    MOVE bestMove = searchBestMove(chessBoard, moves, moveCount, &aiLimits, &bestScore);
+    
+    // Spend the AI's clock and credit the increment
+    if (aiLimits.timeLeft > 0) {
+        aiLimits.timeLeft -= (int)(currentTimeMs() - searchStartTime);
+        aiLimits.timeLeft += aiLimits.increment;
+        if (aiLimits.timeLeft < 1) aiLimits.timeLeft = 1;
+    }
+    
+    if (SHOW_SEARCH_STATS) {
+        printf("Depth %d, %lld nodes; pruned by reverse futility %lld, futility %lld, razoring %lld, move count %lld, history %lld\n",
+               searchCompletedDepth, searchNodes, pruneStats.reverseFutility, pruneStats.futility, pruneStats.razoring,
+               pruneStats.lateMove, pruneStats.history);
+    }
+    
+    makeMove(chessBoard, bestMove);
+    *AI_SCORE = bestScore;
+    
+    int fromX = bestMove.from % 10, fromY = bestMove.from / 10;
+    int toX = bestMove.to % 10, toY = bestMove.to / 10;
+    
+    // Show what type of move was made
+    if (bestMove.capturedPiece != EMPTY) {
+        printf("AI plays: %c%d%c%d (captures %c)\n", 
+               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY, pieceChars[bestMove.capturedPiece]);
+    } else if (bestMove.isCastling) {
+        printf("AI plays: %c%d%c%d (castling)\n", 
+               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
+    } else if (bestMove.promotionPiece != EMPTY) {
+        printf("AI plays: %c%d%c%d (promotes to %c)\n", 
+               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY, pieceChars[bestMove.promotionPiece]);
+    } else {
+        printf("AI plays: %c%d%c%d\n", 
+               'a' + fromX, 8 - fromY, 'a' + toX, 8 - toY);
+    }
+}
 
-        //backward left diagonal (down-left for black)
-        if ((kingX - 1) >= 0 && (kingY + 1) <= 7)
-        {
-            if (chessBoard->board[kingY + 1][kingX - 1].piece == 'K' || chessBoard->board[kingY + 1][kingX - 1].piece == 'P')
-            {
-                return true;
-            }
-            compX = kingX - 1, compY = kingY + 1;
-            while (compX >= 0 && compY <= 7)
-            {
-                if (chessBoard->board[compY][compX].piece >= 97 && chessBoard->board[compY][compX].piece <= 122)
-                {
-                    break;
-                }
-                else if (
-                            chessBoard->board[compY][compX].piece == 'Q' ||
-                            chessBoard->board[compY][compX].piece == 'B'
-                )
-                {
-                    return true;
-                }
-                compX--, compY++;
+// Iterative deepening over the side to move's root moves; returns the best move of the deepest
+// finished iteration. Nothing in here or below it touches the heap
+MOVE searchBestMove(BOARD *chessBoard, MOVE moves[], int moveCount, SEARCHLIMITS *limits, int *bestScoreOut)
+{
+    startSearch(limits);
+    resetSearchStack();
+    
+    TTENTRY *entry = ttProbe(chessBoard->key);
+    unsigned short firstMove = entry ? entry->move : NO_MOVE;
+    MOVE bestMove = moves[0];
+    int bestScore = 0;
+    int completedDepth = 0;
+    
+    // Iterative deepening: each finished iteration replaces the answer, an abandoned one is discarded
+    for (int depth = 1; depth <= limits->depth; depth++) {
+        // Order moves for better tactical play, last iteration's best first
+        orderMoves(chessBoard, moves, moveCount, firstMove, &searchStack[0]);
+        
+        // Aspiration window around the last score; mate scores get the full window
+        int window = ASPIRATION_WINDOW;
+        int alpha = -SCORE_INFINITY, beta = SCORE_INFINITY;
+        if (depth > 1 && abs(bestScore) < SCORE_MATE_BOUND) {
+            alpha = bestScore - window;
+            beta = bestScore + window;
+        }
+        
+        int score;
+        while (true) {
+            score = searchRoot(chessBoard, moves, moveCount, depth, alpha, beta);
+            if (stopSearch) break;
+            
+            // Outside the window the score is only a bound: widen that side and search again
+            if (score <= alpha && alpha > -SCORE_INFINITY) {
+                alpha = (alpha - window > -SCORE_INFINITY) ? alpha - window : -SCORE_INFINITY;
+            } else if (score >= beta && beta < SCORE_INFINITY) {
+                beta = (beta + window < SCORE_INFINITY) ? beta + window : SCORE_INFINITY;
+            } else {
+                break;
             }
+            window *= 2;
         }
-
-        return false;
+        if (stopSearch) break;
+        
+        bestScore = score;
+        bestMove = (pvLength[0] > 0) ? pvTable[0][0] : moves[0];
+        firstMove = packMove(bestMove);
+        completedDepth = depth;
+        
+        previousPvLength = pvLength[0];
+        memcpy(previousPv, pvTable[0], sizeof(MOVE) * previousPvLength);
+        
+        searchCanStop = true;
+        
+        // A mate found within the full-width depth will not get any shorter by searching deeper
+        if (abs(bestScore) >= SCORE_MATE_BOUND && SCORE_MATE - abs(bestScore) <= depth) break;
+        if (searchSoftLimit > 0 && currentTimeMs() >= searchSoftLimit) break;
+        if (searchNodeLimit > 0 && searchNodes >= searchNodeLimit) break;
     }
+    
+    ttStore(chessBoard->key, completedDepth, bestScore, TT_EXACT, packMove(bestMove));
+    searchCompletedDepth = completedDepth;
+    *bestScoreOut = bestScore;
+    return bestMove;
+}
 
+// Fixed positions for -bench: openings, middlegames and endgames with both sides to move
+static const char *benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R b KQ - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r3k2r/pppbbppp/2n2q1P/1P2p3/3pn3/BN2PNP1/P1PPQPB1/R3K2R b KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/8/4k3/8/2p5/8/B2K4/8 b - - 0 1",
+};
 
+// Searches every bench position to a fixed depth from an empty hash table and reports the
+// node count, which only changes when the search does; returns the process exit status
+int runBench(int depth)
+{
+    static BOARD board;
+    static GAMEHISTORY history;
+    board.history = &history;
+    SEARCHLIMITS limits = {depth, 0, 0, 0, 0};
+    int positionCount = sizeof(benchPositions) / sizeof(benchPositions[0]);
+    long long totalNodes = 0;
+    long long startTime = currentTimeMs();
+    bool failed = false;
+    
+    for (int i = 0; i < positionCount; i++) {
+        if (!loadFen(&board, benchPositions[i])) {
+            printf("Bad bench position %s\n", benchPositions[i]);
+            return 1;
+        }
+        MOVE moves[MAX_MOVES];
+        int moveCount;
+        generateMoves(&board, moves, &moveCount, board.sideToMove == WHITE);
+        if (moveCount == 0) continue;
+        
+        ttClear();
+        memset(historyTable, 0, sizeof(historyTable));
+        memset(counterMoves, 0, sizeof(counterMoves));
+        memset(continuationHistory, 0, sizeof(continuationHistory));
+        
+#ifdef DEBUG_ALLOCATIONS
+        long long allocationsBefore = allocationCount;
+#endif
+        int score;
+        MOVE bestMove = searchBestMove(&board, moves, moveCount, &limits, &score);
+        totalNodes += searchNodes;
+        
+        printf("%d: %c%d%c%d score %d, %lld nodes\n", i + 1,
+               'a' + bestMove.from % 10, 8 - bestMove.from / 10, 'a' + bestMove.to % 10, 8 - bestMove.to / 10,
+               score, searchNodes);
+#ifdef DEBUG_ALLOCATIONS
+        if (allocationCount != allocationsBefore) {
+            printf("   %lld heap allocations during the search\n", allocationCount - allocationsBefore);
+            failed = true;
+        }
+#endif
+    }
+    
+    long long elapsed = currentTimeMs() - startTime;
+    printf("Total: %lld nodes, %lld ms, %lld nodes/s\n", totalNodes, elapsed,
+           elapsed > 0 ? totalNodes * 1000 / elapsed : totalNodes);
+    if (failed) printf("FAILED: the search allocated memory\n");
+    return failed ? 1 : 0;
 }
 
-bool basicMoveChecker(int coordStart, int coordDestination, BOARD *chessBoard)
+// Standard perft positions with their published leaf counts for depths 1 to PERFT_MAX_DEPTH
+typedef struct
 {
-    // Check if the move is valid for the piece type (no check validation)
-    int startX = coordStart % 10, startY = coordStart / 10;
-    int endX = coordDestination % 10, endY = coordDestination / 10;
-    char piece = chessBoard->board[startY][startX].piece;
-    char destination = chessBoard->board[endY][endX].piece;
-
-
-    if (piece >= 65 && piece <= 90)
-    {
-        // white pieces
-        switch (piece)
-        {
-            case 'P':   //white pawn
-                // Move forward one
-                if (startX == endX && startY - endY == 1 && checkEmpty(startX, endY, chessBoard))
-                {
-                    break;
-                }
-                // Move forward two from starting position
-                if (startY == 6 && startX == endX && startY - endY == 2)
-                {
-                    if (checkEmpty(startX, startY - 1, chessBoard) && checkEmpty(startX, endY, chessBoard))
-                    {
-                        break;
-                    }
-                }
-                // checks for whether or not take is possible
-                if ((startY - endY == 1 && abs(endX - startX) == 1))
-                {
-                    if (!checkEmpty(endX, endY, chessBoard) && (chessBoard->board[endY][endX].piece >= 97 && chessBoard->board[endY][endX].piece <= 122))
-                    {
-                        break;
-                    }
-                }
-                // Check for en passant
-                if (chessBoard->enPassantFile == endX && 
-                    ((isupper(piece) && startY == 3 && endY == 2) || 
-                     (!isupper(piece) && startY == 4 && endY == 5))) {
-                    break;
-                }
-                return false;
-            case 'R':   //white rook
-                if (startX == endX && startY != endY)
-                {
-                    // vertical
-                    int rookVertical = endY - startY;
-                    int step = (rookVertical > 0) ? 1 : -1;
-                    for (int y = startY + step; y != endY; y += step)
-                    {
-                        if (!checkEmpty(startX, y, chessBoard))
-                            return false;
-                    }
-                }
-                else if (startY == endY && startX != endX)
-                {
-                    // horizontal
-                    int rookHorizontal = endX - startX;
-                    int step = (rookHorizontal > 0) ? 1 : -1;
-                    for (int x = startX + step; x != endX; x += step)
-                    {
-                        if (!checkEmpty(x, startY, chessBoard))
-                            return false;
-                    }
-                }
-                else {
-                    return false;
-                }
+    const char *fen;
+    unsigned long long nodes[PERFT_MAX_DEPTH];
+} PERFTPOSITION;
+
+static const PERFTPOSITION perftPositions[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+     {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     {48, 2039, 97862, 4085603, 193690690, 8031647685ULL}},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+     {14, 191, 2812, 43238, 674624, 11030083}},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+     {6, 264, 9467, 422333, 15833292, 706045033}},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     {44, 1486, 62379, 2103487, 89941194, 3048196529ULL}},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+     {46, 2079, 89890, 3894594, 164075551, 6923051137ULL}},
+};
 
-                if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                    break;
-                return false;
-            case 'N':   //white knight
-            {
-                int dx = abs(endX - startX);
-                int dy = abs(endY - startY);
-                if ((dx == 2 && dy == 1) || (dx == 1 && dy == 2))
-                {
-                    if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                    {
-                        break;
-                    }
-                }
-                return false;
-            }
-            case 'B':   //white bishop
-            {
-                if (abs(endY - startY) != abs(endX - startX))
-                    return false;
+// Counts the leaves of the legal move tree, making and undoing every move on the one board
+unsigned long long perft(BOARD *chessBoard, int depth)
+{
+    MOVE moves[MAX_MOVES];
+    int moveCount;
+    generateMoves(chessBoard, moves, &moveCount, chessBoard->sideToMove == WHITE);
+    if (depth <= 1) return moveCount;
+    
+    unsigned long long nodes = 0;
+    for (int i = 0; i < moveCount; i++) {
+        makeMove(chessBoard, moves[i]);
+        nodes += perft(chessBoard, depth - 1);
+        undoMove(chessBoard, moves[i]);
+    }
+    return nodes;
+}
 
-                int bishopVertical = endY - startY, bishopHorizontal = endX - startX;
-                int stepVertical = (bishopVertical > 0) ? 1 : -1;
-                int stepHorizontal = (bishopHorizontal > 0) ? 1 : -1;
+// Runs perft on every reference position and compares with the published counts, so move
+// generation and make/undo can be checked from the command line; returns the exit status
+int runPerft(int depth)
+{
+    static BOARD board;
+    static GAMEHISTORY history;
+    board.history = &history;
+    if (depth > PERFT_MAX_DEPTH) depth = PERFT_MAX_DEPTH;
+    int positionCount = sizeof(perftPositions) / sizeof(perftPositions[0]);
+    bool failed = false;
+    
+    for (int i = 0; i < positionCount; i++) {
+        if (!loadFen(&board, perftPositions[i].fen)) {
+            printf("Bad perft position %s\n", perftPositions[i].fen);
+            return 1;
+        }
+        long long startTime = currentTimeMs();
+        unsigned long long nodes = perft(&board, depth);
+        unsigned long long expected = perftPositions[i].nodes[depth - 1];
+        printf("%d: depth %d, %llu nodes, expected %llu, %lld ms%s\n", i + 1, depth, nodes, expected,
+               currentTimeMs() - startTime, nodes == expected ? "" : "  MISMATCH");
+        if (nodes != expected) failed = true;
+    }
+    
+    if (failed) printf("FAILED: perft does not match the reference counts\n");
+    return failed ? 1 : 0;
+}
 
-                int x = startX + stepHorizontal;
-                int y = startY + stepVertical;
-                while (x != endX && y != endY)
-                {
-                    if (!checkEmpty(x, y, chessBoard))
-                        return false;
-                    x += stepHorizontal;
-                    y += stepVertical;
-                }
+bool isInCheck(BOARD *chessBoard, bool isWhite)
+{
+    return moveLeavesKingInCheck(chessBoard, isWhite ? 0 : 1);
+}
 
-                if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                    break;
+bool hasLegalMoves(BOARD *chessBoard, bool isWhite)
+{
+    MOVE moves[MAX_MOVES];
+    int moveCount;
+    generateMoves(chessBoard, moves, &moveCount, isWhite);
+    return moveCount > 0;
+}
 
-                return false;
-            }
-            case 'Q':
-            {
-                // Diagonal like a bishop
-                if (abs(endY - startY) == abs(endX - startX))
-                {
-                    int dx = (endX > startX) ? 1 : -1;
-                    int dy = (endY > startY) ? 1 : -1;
-                    int x = startX + dx;
-                    int y = startY + dy;
-
-                    while (x != endX && y != endY)
-                    {
-                        if (!checkEmpty(x, y, chessBoard)) return false;
-                        x += dx;
-                        y += dy;
-                    }
+int gameCheck(BOARD *chessBoard)
+{
+    bool whiteHasMoves = hasLegalMoves(chessBoard, true);
+    bool blackHasMoves = hasLegalMoves(chessBoard, false);
+    bool whiteInCheck = isInCheck(chessBoard, true);
+    bool blackInCheck = isInCheck(chessBoard, false);
+    
+    if (!whiteHasMoves) {
+        if (whiteInCheck) {
+            printf("Checkmate! Black wins!\n");
+            return 1; // checkmate
+        } else {
+            printf("Stalemate!\n");
+            return 2; // stalemate
+        }
+    }
+    
+    if (!blackHasMoves) {
+        if (blackInCheck) {
+            printf("Checkmate! White wins!\n");
+            return 1; // checkmate
+        } else {
+            printf("Stalemate!\n");
+            return 2; // stalemate
+        }
+    }
+    
+    if (chessBoard->halfmoveClock >= FIFTY_MOVE_PLIES) {
+        printf("Draw by the fifty-move rule!\n");
+        return 3; // draw by rule
+    }
+    
+    if (repetitionCount(chessBoard) >= 2) {
+        printf("Draw by threefold repetition!\n");
+        return 3;
+    }
+    
+    return 0; // game continues
+}
 
-                    if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                        break;
-                }
+bool moveLeavesKingInCheck(BOARD *chessBoard, int color)    // 0 for white, 1 for black
+{
+    // return true if the king of the given color is attacked in the current position
+    location king = (color == 0) ? chessBoard->whiteKing : chessBoard->blackKing;
+    return isSquareAttackedBy(chessBoard, SQUARE(king.x, king.y), color ^ 1);
+}
 
-                // Straight line like a rook
-                else if (startX == endX || startY == endY)
-                {
-                    if (startX == endX)
-                    {
-                        int step = (endY > startY) ? 1 : -1;
-                        for (int y = startY + step; y != endY; y += step)
-                        {
-                            if (!checkEmpty(startX, y, chessBoard)) return false;
-                        }
-                    } else if (startY == endY)
-                    {
-                        int step = (endX > startX) ? 1 : -1;
-                        for (int x = startX + step; x != endX; x += step)
-                        {
-                            if (!checkEmpty(x, startY, chessBoard)) return false;
-                        }
-                    }
+bool basicMoveChecker(int coordStart, int coordDestination, BOARD *chessBoard)
+{
+    // Check if the move is valid for the piece type (no check validation)
+    int startX = coordStart % 10, startY = coordStart / 10;
+    int endX = coordDestination % 10, endY = coordDestination / 10;
+    int piece = chessBoard->board[startY][startX];
+    int destination = chessBoard->board[endY][endX];
+    int fromSq = SQUARE(startX, startY);
+    U64 toBit = SQUARE_BIT(SQUARE(endX, endY));
+    int dx = abs(endX - startX), dy = abs(endY - startY);
 
-                    if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                        break;
-                }
+    if (piece == EMPTY)
+        return false;
 
-                return false;
-            }
-            case 'K':   //white king
-                // Check for castling first
-                if (abs(endX - startX) == 2 && startY == endY) {
-                    return canCastle(chessBoard, true, endX > startX);
-                }
+    // No piece may land on one of its own side
+    int color = pieceColor(piece);
+    if (destination != EMPTY && pieceColor(destination) == color)
+        return false;
 
-                // Regular king moves (1 square)
-                if (abs(endY - startY) == abs(endX - startX) && abs(endY - startY) == 1)
-                {
-                    if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                        break;
-                }
-                else if ((startX == endX && abs(endY - startY) == 1)|| (startY == endY && abs(endX - startX) == 1))
-                {
-                    if (destination == ' ' || (destination >= 'a' && destination <= 'z'))
-                        break;
-                }
+    // Pawns move up the board (towards y = 0) for white, down for black
+    int forward = (color == WHITE) ? -1 : 1;
+    int pawnStartY = (color == WHITE) ? 6 : 1;
 
-                return false;
-        }
-    }
-    else if (piece >= 97 && piece <= 122)
+    switch (pieceType(piece))
     {
-        // black pieces
-        switch (piece)
-        {
-            case 'p':   //black pawn
-                // Move forward one (down for black)
-                if (startX == endX && endY - startY == 1 && checkEmpty(startX, endY, chessBoard))
-                {
-                    break;
-                }
-                // Move forward two from starting position
-                if (startY == 1 && startX == endX && endY - startY == 2)
-                {
-                    if (checkEmpty(startX, startY + 1, chessBoard) && checkEmpty(startX, endY, chessBoard))
-                    {
-                        break;
-                    }
-                }
-                // checks for whether or not take is possible
-                if ((endY - startY == 1 && abs(endX - startX) == 1))
-                {
-                    if (!checkEmpty(endX, endY, chessBoard) && (chessBoard->board[endY][endX].piece >= 65 && chessBoard->board[endY][endX].piece <= 90))
-                    {
-                        break;
-                    }
-                }
-                // Check for en passant  
-                if (chessBoard->enPassantFile == endX && 
-                    ((isupper(piece) && startY == 3 && endY == 2) || 
-                     (!isupper(piece) && startY == 4 && endY == 5))) {
-                    break;
-                }
-                return false;
-            case 'r':   //black rook
-                if (startX == endX && startY != endY)
-                {
-                    // vertical
-                    int rookVertical = endY - startY;
-                    int step = (rookVertical > 0) ? 1 : -1;
-                    for (int y = startY + step; y != endY; y += step)
-                    {
-                        if (!checkEmpty(startX, y, chessBoard))
-                            return false;
-                    }
-                }
-                else if (startY == endY && startX != endX)
-                {
-                    // horizontal
-                    int rookHorizontal = endX - startX;
-                    int step = (rookHorizontal > 0) ? 1 : -1;
-                    for (int x = startX + step; x != endX; x += step)
-                    {
-                        if (!checkEmpty(x, startY, chessBoard))
-                            return false;
-                    }
-                }
-                else {
-                    return false;
-                }
-
-                if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                    break;
-                return false;
-            case 'n':   //black knight
+        case PAWN:
+            // Move forward one
+            if (startX == endX && endY - startY == forward && destination == EMPTY)
             {
-                int dx = abs(endX - startX);
-                int dy = abs(endY - startY);
-                if ((dx == 2 && dy == 1) || (dx == 1 && dy == 2))
-                {
-                    if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                    {
-                        break;
-                    }
-                }
-                return false;
+                break;
             }
-            case 'b':   //black bishop
+            // Move forward two from starting position
+            if (startY == pawnStartY && startX == endX && endY - startY == 2 * forward)
             {
-                if (abs(endY - startY) != abs(endX - startX))
-                    return false;
-
-                int bishopVertical = endY - startY, bishopHorizontal = endX - startX;
-                int stepVertical = (bishopVertical > 0) ? 1 : -1;
-                int stepHorizontal = (bishopHorizontal > 0) ? 1 : -1;
-
-                int x = startX + stepHorizontal;
-                int y = startY + stepVertical;
-                while (x != endX && y != endY)
+                if (checkEmpty(startX, startY + forward, chessBoard) && destination == EMPTY)
                 {
-                    if (!checkEmpty(x, y, chessBoard))
-                        return false;
-                    x += stepHorizontal;
-                    y += stepVertical;
-                }
-
-                if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
                     break;
-
-                return false;
+                }
             }
-            case 'q':   //black queen
+            // checks for whether or not take is possible
+            if (endY - startY == forward && dx == 1 && destination != EMPTY)
             {
-                // Diagonal like a bishop
-                if (abs(endY - startY) == abs(endX - startX))
-                {
-                    int dx = (endX > startX) ? 1 : -1;
-                    int dy = (endY > startY) ? 1 : -1;
-                    int x = startX + dx;
-                    int y = startY + dy;
-
-                    while (x != endX && y != endY)
-                    {
-                        if (!checkEmpty(x, y, chessBoard)) return false;
-                        x += dx;
-                        y += dy;
-                    }
-
-                    if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                        break;
-                }
-
-                // Straight line like a rook
-                else if (startX == endX || startY == endY)
-                {
-                    if (startX == endX)
-                    {
-                        int step = (endY > startY) ? 1 : -1;
-                        for (int y = startY + step; y != endY; y += step)
-                        {
-                            if (!checkEmpty(startX, y, chessBoard)) return false;
-                        }
-                    } else if (startY == endY)
-                    {
-                        int step = (endX > startX) ? 1 : -1;
-                        for (int x = startX + step; x != endX; x += step)
-                        {
-                            if (!checkEmpty(x, startY, chessBoard)) return false;
-                        }
-                    }
-
-                    if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                        break;
-                }
-
-                return false;
+                break;
             }
-            case 'k':   //black king
-                // Check for castling first
-                if (abs(endX - startX) == 2 && startY == endY) {
-                    return canCastle(chessBoard, false, endX > startX);
-                }
-
-                // Regular king moves (1 square)
-                if (abs(endY - startY) == abs(endX - startX) && abs(endY - startY) == 1)
-                {
-                    if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                        break;
-                }
-                else if ((startX == endX && abs(endY - startY) == 1)|| (startY == endY && abs(endX - startX) == 1))
-                {
-                    if (destination == ' ' || (destination >= 'A' && destination <= 'Z'))
-                        break;
-                }
-
+            // Check for en passant
+            if (chessBoard->enPassantFile == endX && 
+                ((color == WHITE && startY == 3 && endY == 2) || 
+                 (color == BLACK && startY == 4 && endY == 5))) {
+                break;
+            }
+            return false;
+        case ROOK:
+            if (!(rookAttacks(fromSq, chessBoard->occupied) & toBit))
+                return false;
+            break;
+        case KNIGHT:
+            if ((dx == 2 && dy == 1) || (dx == 1 && dy == 2))
+                break;
+            return false;
+        case BISHOP:
+            if (!(bishopAttacks(fromSq, chessBoard->occupied) & toBit))
+                return false;
+            break;
+        case QUEEN:
+        {
+            // Rook and bishop lines combined
+            U64 queenAttacks = rookAttacks(fromSq, chessBoard->occupied) | bishopAttacks(fromSq, chessBoard->occupied);
+            if (!(queenAttacks & toBit))
                 return false;
+            break;
         }
+        case KING:
+            // Check for castling first
+            if (dx == 2 && startY == endY) {
+                return canCastle(chessBoard, color == WHITE, endX > startX);
+            }
+
+            // Regular king moves (1 square)
+            if (dx <= 1 && dy <= 1 && (dx | dy))
+                break;
+            return false;
     }
     
     return true;
@@ -2161,35 +2611,32 @@ bool moveChecker(int coordStart, int coordDestination, BOARD *chessBoard)
         return false;
     }
     
-    // Create temporary board to test if move leaves king in check
-    BOARD *testBoard = copyBoard(chessBoard);
-    
-    // Make the move on test board
+    // Try the move and take it back to see whether it leaves the king in check
     int startX = coordStart % 10, startY = coordStart / 10;
     int endX = coordDestination % 10, endY = coordDestination / 10;
-    char piece = chessBoard->board[startY][startX].piece;
+    int piece = chessBoard->board[startY][startX];
     
     MOVE move;
     move.from = coordStart;
     move.to = coordDestination;
     move.movedPiece = piece;
-    move.capturedPiece = chessBoard->board[endY][endX].piece;
-    move.promotionPiece = ' ';
-    move.isCastling = (tolower(piece) == 'k' && abs(endX - startX) == 2);
-    move.isEnPassant = (tolower(piece) == 'p' && abs(endX - startX) == 1 && 
-                        chessBoard->board[endY][endX].piece == ' ' &&
+    move.capturedPiece = chessBoard->board[endY][endX];
+    move.promotionPiece = EMPTY;
+    move.isCastling = (pieceType(piece) == KING && abs(endX - startX) == 2);
+    move.isEnPassant = (pieceType(piece) == PAWN && abs(endX - startX) == 1 && 
+                        chessBoard->board[endY][endX] == EMPTY &&
                         chessBoard->enPassantFile == endX);
     
-    makeMove(testBoard, move);
-    bool leavesKingInCheck = moveLeavesKingInCheck(testBoard, (piece >= 65 && piece <= 90) ? 0 : 1);
-    freeBoard(testBoard);
+    makeMove(chessBoard, move);
+    bool leavesKingInCheck = moveLeavesKingInCheck(chessBoard, pieceColor(piece));
+    undoMove(chessBoard, move);
     
     return !leavesKingInCheck;
 }
 
 bool checkEmpty(int x, int y, BOARD *chessBoard)
 {
-    if (chessBoard->board[y][x].piece == ' ')
+    if (chessBoard->board[y][x] == EMPTY)
     {
         return true;
     }
@@ -2199,131 +2646,112 @@ bool checkEmpty(int x, int y, BOARD *chessBoard)
 bool isSquareAttacked(BOARD *chessBoard, int x, int y, bool byWhite)
 {
     // Use the precomputed attack maps for efficiency
-    if (byWhite) {
-        return chessBoard->whiteAttacks[y][x];
-    } else {
-        return chessBoard->blackAttacks[y][x];
-    }
+    return (chessBoard->attacks[byWhite ? WHITE : BLACK] & SQUARE_BIT(SQUARE(x, y))) != 0;
 }
 
-int getPieceValue(char piece)
+int getPieceValue(int piece)
 {
-    switch (tolower(piece)) {
-        case 'p': return VALUE_PAWN;
-        case 'n': return VALUE_KNIGHT;
-        case 'b': return VALUE_BISHOP;
-        case 'r': return VALUE_ROOK;
-        case 'q': return VALUE_QUEEN;
-        case 'k': return VALUE_KING;
-        default: return 0;
-    }
+    return pieceValues[piece];
 }
 
-int countAttackers(BOARD *chessBoard, int x, int y, bool isWhite)
+// Swap-list static exchange evaluation: the material the moving side comes out with after both
+// sides keep recapturing on the target square with their least valuable attacker
+int staticExchange(BOARD *chessBoard, MOVE move)
 {
-    int count = 0;
-    for (int sy = 0; sy < 8; sy++) {
-        for (int sx = 0; sx < 8; sx++) {
-            char piece = chessBoard->board[sy][sx].piece;
-            if (piece == ' ') continue;
-            
-            bool isPieceWhite = isupper(piece);
-            if (isPieceWhite != isWhite) continue;
-            
-            int from = sy * 10 + sx;
-            int to = y * 10 + x;
-            
-            if (basicMoveChecker(from, to, chessBoard)) {
-                count++;
-            }
-        }
+    int from = COORD_TO_SQUARE(move.from), to = COORD_TO_SQUARE(move.to);
+    int color = pieceColor(move.movedPiece);
+    U64 occupied = chessBoard->occupied ^ SQUARE_BIT(from);
+    U64 diagonal = chessBoard->pieceBB[WHITE][BISHOP] | chessBoard->pieceBB[BLACK][BISHOP] |
+                   chessBoard->pieceBB[WHITE][QUEEN] | chessBoard->pieceBB[BLACK][QUEEN];
+    U64 straight = chessBoard->pieceBB[WHITE][ROOK] | chessBoard->pieceBB[BLACK][ROOK] |
+                   chessBoard->pieceBB[WHITE][QUEEN] | chessBoard->pieceBB[BLACK][QUEEN];
+    int gain[32];
+    int depth = 0;
+    
+    gain[0] = getPieceValue(move.capturedPiece);
+    int onSquare = getPieceValue(move.movedPiece);
+    if (move.promotionPiece != EMPTY) {
+        gain[0] += getPieceValue(move.promotionPiece) - VALUE_PAWN;
+        onSquare = getPieceValue(move.promotionPiece);
     }
-    return count;
-}
-
-bool isPieceHanging(BOARD *chessBoard, int x, int y)
-{
-    char piece = chessBoard->board[y][x].piece;
-    if (piece == ' ') return false;
-    
-    bool isPieceWhite = isupper(piece);
+    if (move.isEnPassant) occupied ^= SQUARE_BIT(SQUARE(move.to % 10, move.from / 10));
     
-    // Count attackers and defenders
-    int attackers = countAttackers(chessBoard, x, y, !isPieceWhite);
-    int defenders = countAttackers(chessBoard, x, y, isPieceWhite);
-    
-    // If more attackers than defenders, piece might be hanging
-    if (attackers > defenders) {
-        return true;
-    }
+    // Removing a piece from occupied uncovers any slider behind it (x-rays)
+    U64 attackers = (attackersTo(chessBoard, to, WHITE, occupied) | attackersTo(chessBoard, to, BLACK, occupied)) & occupied;
+    color ^= 1;
     
-    // Even if equal, check if lowest value attacker < piece value
-    if (attackers > 0) {
-        int pieceValue = getPieceValue(piece);
+    while (depth < 31) {
+        U64 ours = attackers & chessBoard->colorBB[color];
+        if (!ours) break;
         
-        // Find lowest value attacker
-        int lowestAttackerValue = VALUE_KING;
-        for (int sy = 0; sy < 8; sy++) {
-            for (int sx = 0; sx < 8; sx++) {
-                char attackPiece = chessBoard->board[sy][sx].piece;
-                if (attackPiece == ' ') continue;
-                
-                bool isAttackerWhite = isupper(attackPiece);
-                if (isAttackerWhite == isPieceWhite) continue;
-                
-                int from = sy * 10 + sx;
-                int to = y * 10 + x;
-                
-                if (basicMoveChecker(from, to, chessBoard)) {
-                    int attackerValue = getPieceValue(attackPiece);
-                    if (attackerValue < lowestAttackerValue) {
-                        lowestAttackerValue = attackerValue;
-                    }
-                }
-            }
-        }
+        int type = PAWN;
+        while (!(ours & chessBoard->pieceBB[color][type])) type++;
+        // The king can only take last, when nothing is left to recapture
+        if (type == KING && (attackers & chessBoard->colorBB[color ^ 1])) break;
         
-        if (lowestAttackerValue < pieceValue) {
-            return true;
-        }
+        depth++;
+        gain[depth] = onSquare - gain[depth - 1];
+        onSquare = pieceTypeValues[type];
+        
+        U64 attacker = ours & chessBoard->pieceBB[color][type];
+        occupied ^= attacker & -attacker;
+        if (type == PAWN || type == BISHOP || type == QUEEN) attackers |= bishopAttacks(to, occupied) & diagonal;
+        if (type == ROOK || type == QUEEN) attackers |= rookAttacks(to, occupied) & straight;
+        attackers &= occupied;
+        color ^= 1;
     }
     
-    return false;
+    // Each side may stop capturing once continuing would cost it material
+    while (depth > 0) {
+        if (gain[depth] > -gain[depth - 1]) gain[depth - 1] = -gain[depth];
+        depth--;
+    }
+    return gain[0];
 }
 
-int evaluateCaptures(BOARD *chessBoard, MOVE move)
+// MVV-LVA (Most Valuable Victim - Least Valuable Attacker) tiebreak within the capture bands
+int evaluateCaptures(MOVE move)
 {
-    if (move.capturedPiece == ' ') return 0;
-    
-    int capturedValue = getPieceValue(move.capturedPiece);
-    int capturingValue = getPieceValue(move.movedPiece);
-    
-    // Basic MVV-LVA (Most Valuable Victim - Least Valuable Attacker)
-    int score = capturedValue * 10 - capturingValue;
-    
-    // Bonus if the captured piece was hanging
-    int toX = move.to % 10, toY = move.to / 10;
-    if (isPieceHanging(chessBoard, toX, toY)) {
-        score += 100; // Big bonus for capturing hanging pieces
-    }
+    if (move.capturedPiece == EMPTY) return 0;
     
-    return score;
+    return getPieceValue(move.capturedPiece) * 10 - getPieceValue(move.movedPiece);
 }
 
-void orderMoves(BOARD *chessBoard, MOVE moves[], int moveCount)
+void orderMoves(BOARD *chessBoard, MOVE moves[], int moveCount, unsigned short hashMove, SEARCHSTACK *stack)
 {
-    // Simple move ordering: captures first, then other moves
+    // Hash move, then captures and promotions, then killers, then the other quiet moves by history
     for (int i = 0; i < moveCount; i++) {
         moves[i].score = 0;
+        unsigned short packed = packMove(moves[i]);
         
-        // Prioritize captures
-        if (moves[i].capturedPiece != ' ') {
-            moves[i].score += evaluateCaptures(chessBoard, moves[i]);
+        // The move the transposition table remembers for this position goes first
+        if (hashMove != NO_MOVE && packed == hashMove) {
+            moves[i].score = ORDER_HASH_MOVE;
+            continue;
         }
         
-        // Prioritize promotions
-        if (moves[i].promotionPiece != ' ') {
-            moves[i].score += getPieceValue(moves[i].promotionPiece) * 8;
+        if (moves[i].capturedPiece != EMPTY || moves[i].promotionPiece != EMPTY) {
+            moves[i].score = staticExchange(chessBoard, moves[i]) >= 0 ? ORDER_CAPTURE : ORDER_LOSING_CAPTURE;
+            
+            // Prioritize captures
+            if (moves[i].capturedPiece != EMPTY) {
+                moves[i].score += evaluateCaptures(moves[i]);
+            }
+            
+            // Prioritize promotions
+            if (moves[i].promotionPiece != EMPTY) {
+                moves[i].score += getPieceValue(moves[i].promotionPiece) * 8;
+            }
+        } else if (stack != NULL && packed == stack->killers[0]) {
+            moves[i].score = ORDER_KILLER_1;
+        } else if (stack != NULL && packed == stack->killers[1]) {
+            moves[i].score = ORDER_KILLER_2;
+        } else if (stack != NULL && stack[-1].movedPiece >= 0 && packed == counterMoves[stack[-1].movedPiece][stack[-1].toSquare]) {
+            moves[i].score = ORDER_COUNTER_MOVE;
+        } else if (stack != NULL) {
+            moves[i].score = quietHistoryScore(stack, pieceColor(moves[i].movedPiece), pieceIndex(moves[i].movedPiece), packed & 63, (packed >> 6) & 63);
+        } else {
+            moves[i].score = historyTable[pieceColor(moves[i].movedPiece)][packed & 63][(packed >> 6) & 63];
         }
         
         // Prioritize castling
@@ -2333,7 +2761,7 @@ void orderMoves(BOARD *chessBoard, MOVE moves[], int moveCount)
         
         // Penalty for moving pieces to attacked squares
         int toX = moves[i].to % 10, toY = moves[i].to / 10;
-        bool movedPieceWhite = isupper(moves[i].movedPiece);
+        bool movedPieceWhite = pieceColor(moves[i].movedPiece) == WHITE;
         if (isSquareAttacked(chessBoard, toX, toY, !movedPieceWhite)) {
             moves[i].score -= getPieceValue(moves[i].movedPiece) / 2;
         }
@@ -2356,52 +2784,30 @@ bool canCastle(BOARD *chessBoard, bool isWhite, bool kingside)
     if (isWhite) {
         if (kingside && !chessBoard->whiteCanCastleKingside) return false;
         if (!kingside && !chessBoard->whiteCanCastleQueenside) return false;
+        if (chessBoard->board[7][kingside ? 7 : 0] != WHITE_ROOK) return false; // Rook may have been captured
         if (isInCheck(chessBoard, true)) return false; // Can't castle out of check
         
         // Check squares between king and rook are empty
         if (kingside) {
             if (!checkEmpty(5, 7, chessBoard) || !checkEmpty(6, 7, chessBoard)) return false;
-            // Check that king doesn't pass through check
-            BOARD *testBoard = copyBoard(chessBoard);
-            testBoard->board[7][5] = testBoard->board[7][4]; // Move king one square
-            testBoard->board[7][4].piece = ' ';
-            testBoard->whiteKing.x = 5;
-            bool passesThoughCheck = moveLeavesKingInCheck(testBoard, 0);
-            freeBoard(testBoard);
-            if (passesThoughCheck) return false;
+            // Check that king doesn't pass through or land in check
+            if (isSquareAttackedBy(chessBoard, SQUARE(5, 7), BLACK) || isSquareAttackedBy(chessBoard, SQUARE(6, 7), BLACK)) return false;
         } else {
             if (!checkEmpty(1, 7, chessBoard) || !checkEmpty(2, 7, chessBoard) || !checkEmpty(3, 7, chessBoard)) return false;
-            BOARD *testBoard = copyBoard(chessBoard);
-            testBoard->board[7][3] = testBoard->board[7][4]; // Move king one square
-            testBoard->board[7][4].piece = ' ';
-            testBoard->whiteKing.x = 3;
-            bool passesThoughCheck = moveLeavesKingInCheck(testBoard, 0);
-            freeBoard(testBoard);
-            if (passesThoughCheck) return false;
+            if (isSquareAttackedBy(chessBoard, SQUARE(3, 7), BLACK) || isSquareAttackedBy(chessBoard, SQUARE(2, 7), BLACK)) return false;
         }
     } else {
         if (kingside && !chessBoard->blackCanCastleKingside) return false;
         if (!kingside && !chessBoard->blackCanCastleQueenside) return false;
+        if (chessBoard->board[0][kingside ? 7 : 0] != BLACK_ROOK) return false;
         if (isInCheck(chessBoard, false)) return false;
         
         if (kingside) {
             if (!checkEmpty(5, 0, chessBoard) || !checkEmpty(6, 0, chessBoard)) return false;
-            BOARD *testBoard = copyBoard(chessBoard);
-            testBoard->board[0][5] = testBoard->board[0][4];
-            testBoard->board[0][4].piece = ' ';
-            testBoard->blackKing.x = 5;
-            bool passesThoughCheck = moveLeavesKingInCheck(testBoard, 1);
-            freeBoard(testBoard);
-            if (passesThoughCheck) return false;
+            if (isSquareAttackedBy(chessBoard, SQUARE(5, 0), WHITE) || isSquareAttackedBy(chessBoard, SQUARE(6, 0), WHITE)) return false;
         } else {
             if (!checkEmpty(1, 0, chessBoard) || !checkEmpty(2, 0, chessBoard) || !checkEmpty(3, 0, chessBoard)) return false;
-            BOARD *testBoard = copyBoard(chessBoard);
-            testBoard->board[0][3] = testBoard->board[0][4];
-            testBoard->board[0][4].piece = ' ';
-            testBoard->blackKing.x = 3;
-            bool passesThoughCheck = moveLeavesKingInCheck(testBoard, 1);
-            freeBoard(testBoard);
-            if (passesThoughCheck) return false;
+            if (isSquareAttackedBy(chessBoard, SQUARE(3, 0), WHITE) || isSquareAttackedBy(chessBoard, SQUARE(2, 0), WHITE)) return false;
         }
     }
     return true;
@@ -2415,9 +2821,9 @@ void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool
             MOVE move;
             move.from = 74; // e1
             move.to = 76;   // g1
-            move.movedPiece = 'K';
-            move.capturedPiece = ' ';
-            move.promotionPiece = ' ';
+            move.movedPiece = WHITE_KING;
+            move.capturedPiece = EMPTY;
+            move.promotionPiece = EMPTY;
             move.isCastling = true;
             move.isEnPassant = false;
             move.score = 0;
@@ -2429,9 +2835,9 @@ void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool
             MOVE move;
             move.from = 74; // e1
             move.to = 72;   // c1
-            move.movedPiece = 'K';
-            move.capturedPiece = ' ';
-            move.promotionPiece = ' ';
+            move.movedPiece = WHITE_KING;
+            move.capturedPiece = EMPTY;
+            move.promotionPiece = EMPTY;
             move.isCastling = true;
             move.isEnPassant = false;
             move.score = 0;
@@ -2443,9 +2849,9 @@ void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool
             MOVE move;
             move.from = 4;  // e8
             move.to = 6;    // g8
-            move.movedPiece = 'k';
-            move.capturedPiece = ' ';
-            move.promotionPiece = ' ';
+            move.movedPiece = BLACK_KING;
+            move.capturedPiece = EMPTY;
+            move.promotionPiece = EMPTY;
             move.isCastling = true;
             move.isEnPassant = false;
             move.score = 0;
@@ -2457,9 +2863,9 @@ void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool
             MOVE move;
             move.from = 4;  // e8
             move.to = 2;    // c8
-            move.movedPiece = 'k';
-            move.capturedPiece = ' ';
-            move.promotionPiece = ' ';
+            move.movedPiece = BLACK_KING;
+            move.capturedPiece = EMPTY;
+            move.promotionPiece = EMPTY;
             move.isCastling = true;
             move.isEnPassant = false;
             move.score = 0;
@@ -2471,54 +2877,289 @@ void generateCastlingMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool
 void generateEnPassantMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite)
 {
     if (chessBoard->enPassantFile == -1) return;
+    if (chessBoard->enPassantRank != (isWhite ? 2 : 5)) return;
     
-    int targetFile = chessBoard->enPassantFile;
-    int targetRank = chessBoard->enPassantRank;
+    int color = isWhite ? WHITE : BLACK;
+    int targetSq = SQUARE(chessBoard->enPassantFile, chessBoard->enPassantRank);
+    int capturedSq = isWhite ? targetSq + 8 : targetSq - 8;
     
-    // Check for pawns that can capture en passant
-    for (int x = 0; x < 8; x++) {
-        for (int y = 0; y < 8; y++) {
-            char piece = chessBoard->board[y][x].piece;
-            if (piece == ' ') continue;
-            
-            bool isPieceWhite = isupper(piece);
-            if (isPieceWhite != isWhite) continue;
-            
-            if (tolower(piece) == 'p') {
-                // Check if this pawn can capture en passant
-                if (abs(x - targetFile) == 1) {
-                    int correctRank = isWhite ? 3 : 4; // White pawns on rank 5, black on rank 4
-                    if (y == correctRank) {
-                        MOVE move;
-                        move.from = y * 10 + x;
-                        move.to = targetRank * 10 + targetFile;
-                        move.movedPiece = piece;
-                        move.capturedPiece = isWhite ? 'p' : 'P';
-                        move.promotionPiece = ' ';
-                        move.isCastling = false;
-                        move.isEnPassant = true;
-                        move.score = 0;
-                        moves[(*moveCount)++] = move;
-                    }
-                }
-            }
+    // Only valid while the pawn that made the double step is still standing next to the target
+    if ((chessBoard->occupied & SQUARE_BIT(targetSq)) ||
+        !(chessBoard->pieceBB[color ^ 1][PAWN] & SQUARE_BIT(capturedSq))) return;
+    
+    // Our pawns that could capture onto the target are the ones an enemy pawn there would attack
+    U64 attackers = pawnAttacks[color ^ 1][targetSq] & chessBoard->pieceBB[color][PAWN];
+    while (attackers) {
+        int fromSq = popLsb(&attackers);
+        MOVE move;
+        move.from = SQUARE_TO_COORD(fromSq);
+        move.to = SQUARE_TO_COORD(targetSq);
+        move.movedPiece = isWhite ? WHITE_PAWN : BLACK_PAWN;
+        move.capturedPiece = isWhite ? BLACK_PAWN : WHITE_PAWN;
+        move.promotionPiece = EMPTY;
+        move.isCastling = false;
+        move.isEnPassant = true;
+        move.score = 0;
+        moves[(*moveCount)++] = move;
+    }
+}
+
+// Finds the checkers and the pinned pieces of the side to move
+static void computeMoveMasks(BOARD *chessBoard, bool isWhite, MOVEMASKS *masks)
+{
+    int color = isWhite ? WHITE : BLACK;
+    location king = isWhite ? chessBoard->whiteKing : chessBoard->blackKing;
+    U64 *enemy = chessBoard->pieceBB[color ^ 1];
+    
+    masks->kingSq = SQUARE(king.x, king.y);
+    
+    U64 checkers = attackersTo(chessBoard, masks->kingSq, color ^ 1, chessBoard->occupied);
+    masks->checkerCount = popCount(checkers);
+    if (masks->checkerCount == 0) {
+        masks->checkMask = ~0ULL;
+    } else if (masks->checkerCount == 1) {
+        int checkerSq = __builtin_ctzll(checkers);
+        masks->checkMask = betweenBB[masks->kingSq][checkerSq] | checkers;
+    } else {
+        masks->checkMask = 0;
+    }
+    
+    // Enemy sliders looking at the king through exactly one of our pieces pin it
+    U64 snipers = (rookAttacks(masks->kingSq, 0) & (enemy[ROOK] | enemy[QUEEN])) |
+                  (bishopAttacks(masks->kingSq, 0) & (enemy[BISHOP] | enemy[QUEEN]));
+    masks->pinned = 0;
+    while (snipers) {
+        U64 blockers = betweenBB[masks->kingSq][popLsb(&snipers)] & chessBoard->occupied;
+        if (popCount(blockers) == 1) masks->pinned |= blockers & chessBoard->colorBB[color];
+    }
+}
+
+static void addMove(BOARD *chessBoard, MOVE moves[], int *moveCount, int fromSq, int toSq)
+{
+    MOVE move;
+    move.from = SQUARE_TO_COORD(fromSq);
+    move.to = SQUARE_TO_COORD(toSq);
+    move.movedPiece = chessBoard->board[fromSq / 8][fromSq % 8];
+    move.capturedPiece = chessBoard->board[toSq / 8][toSq % 8];
+    move.promotionPiece = EMPTY;
+    move.isCastling = false;
+    move.isEnPassant = false;
+    move.score = 0;
+    moves[(*moveCount)++] = move;
+}
+
+// Emits one move per target bit, all from the same square
+static void addMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, int fromSq, U64 targets)
+{
+    while (targets) {
+        addMove(chessBoard, moves, moveCount, fromSq, popLsb(&targets));
+    }
+}
+
+// Pawn moves for a whole target set: fromOffset is the square difference from the target back to the pawn
+static void addPawnMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, U64 targets, int fromOffset, const MOVEMASKS *masks)
+{
+    U64 promotionRank = RANK_BB(isWhite ? 0 : 7);
+    
+    targets &= masks->checkMask;
+    while (targets) {
+        int toSq = popLsb(&targets);
+        int fromSq = toSq + fromOffset;
+        if ((masks->pinned & SQUARE_BIT(fromSq)) && !(lineBB[masks->kingSq][fromSq] & SQUARE_BIT(toSq))) continue;
+        
+        if (SQUARE_BIT(toSq) & promotionRank) {
+            generatePromotionMoves(chessBoard, moves, moveCount, isWhite, SQUARE_TO_COORD(fromSq), SQUARE_TO_COORD(toSq));
+        } else {
+            addMove(chessBoard, moves, moveCount, fromSq, toSq);
+        }
+    }
+}
+
+// Where a non-king piece on sq may go once checks and pins are taken into account
+static inline U64 allowedTargets(const MOVEMASKS *masks, int sq, U64 targets)
+{
+    targets &= masks->checkMask;
+    if (masks->pinned & SQUARE_BIT(sq)) targets &= lineBB[masks->kingSq][sq];
+    return targets;
+}
+
+// Shared generator: the masks restrict every move so that only legal ones are produced
+static void generateMaskedMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, int genType, const MOVEMASKS *masks)
+{
+    int color = isWhite ? WHITE : BLACK;
+    U64 *own = chessBoard->pieceBB[color];
+    U64 enemies = chessBoard->colorBB[color ^ 1];
+    U64 empty = ~chessBoard->occupied;
+    U64 targets = (genType == GEN_CAPTURES || genType == GEN_TACTICAL) ? enemies : (genType == GEN_QUIETS) ? empty : ~chessBoard->colorBB[color];
+    
+    *moveCount = 0;
+    
+    // King moves first: in double check nothing else is possible
+    U64 bb = own[KING];
+    while (bb) {
+        int sq = popLsb(&bb);
+        U64 kingTargets = kingAttacks[sq] & targets;
+        // The king must not step along a checking ray, so look through its own square
+        U64 occupiedWithoutKing = chessBoard->occupied ^ SQUARE_BIT(sq);
+        U64 candidates = kingTargets;
+        while (candidates) {
+            int to = popLsb(&candidates);
+            if (attackersTo(chessBoard, to, color ^ 1, occupiedWithoutKing)) kingTargets &= ~SQUARE_BIT(to);
+        }
+        addMoves(chessBoard, moves, moveCount, sq, kingTargets);
+    }
+    if (masks->checkerCount > 1) return;
+    
+    // Pawns, set-wise: pushes are quiet, diagonal steps are captures
+    U64 pawns = own[PAWN];
+    if (genType == GEN_ALL || genType == GEN_QUIETS) {
+        U64 singlePushes, doublePushes;
+        if (isWhite) {
+            singlePushes = (pawns >> 8) & empty;
+            doublePushes = ((singlePushes & RANK_BB(5)) >> 8) & empty;
+        } else {
+            singlePushes = (pawns << 8) & empty;
+            doublePushes = ((singlePushes & RANK_BB(2)) << 8) & empty;
+        }
+        addPawnMoves(chessBoard, moves, moveCount, isWhite, singlePushes, isWhite ? 8 : -8, masks);
+        addPawnMoves(chessBoard, moves, moveCount, isWhite, doublePushes, isWhite ? 16 : -16, masks);
+    } else if (genType == GEN_TACTICAL) {
+        // Of the quiet moves only pushes to the last rank, and of those only the queen
+        U64 promotionPushes = (isWhite ? pawns >> 8 : pawns << 8) & empty & RANK_BB(isWhite ? 0 : 7);
+        int firstPromotion = *moveCount;
+        addPawnMoves(chessBoard, moves, moveCount, isWhite, promotionPushes, isWhite ? 8 : -8, masks);
+        int queenCount = firstPromotion;
+        for (int i = firstPromotion; i < *moveCount; i++) {
+            if (pieceType(moves[i].promotionPiece) == QUEEN) moves[queenCount++] = moves[i];
+        }
+        *moveCount = queenCount;
+    }
+    if (genType != GEN_QUIETS) {
+        if (isWhite) {
+            addPawnMoves(chessBoard, moves, moveCount, true, ((pawns & ~FILE_A_BB) >> 9) & enemies, 9, masks);
+            addPawnMoves(chessBoard, moves, moveCount, true, ((pawns & ~FILE_H_BB) >> 7) & enemies, 7, masks);
+        } else {
+            addPawnMoves(chessBoard, moves, moveCount, false, ((pawns & ~FILE_H_BB) << 9) & enemies, -9, masks);
+            addPawnMoves(chessBoard, moves, moveCount, false, ((pawns & ~FILE_A_BB) << 7) & enemies, -7, masks);
         }
+        
+        // En passant removes two pieces from one rank, which the masks cannot express
+        // (the horizontal discovered check), so these few moves get the full occupancy test
+        int firstEnPassant = *moveCount;
+        generateEnPassantMoves(chessBoard, moves, moveCount, isWhite);
+        int legalCount = firstEnPassant;
+        for (int i = firstEnPassant; i < *moveCount; i++) {
+            if (isLegalMove(chessBoard, moves[i])) moves[legalCount++] = moves[i];
+        }
+        *moveCount = legalCount;
+    }
+    
+    bb = own[KNIGHT] & ~masks->pinned;  // a pinned knight can never move
+    while (bb) {
+        int sq = popLsb(&bb);
+        addMoves(chessBoard, moves, moveCount, sq, allowedTargets(masks, sq, knightAttacks[sq] & targets));
+    }
+    
+    bb = own[BISHOP];
+    while (bb) {
+        int sq = popLsb(&bb);
+        addMoves(chessBoard, moves, moveCount, sq, allowedTargets(masks, sq, bishopAttacks(sq, chessBoard->occupied) & targets));
+    }
+    
+    bb = own[ROOK];
+    while (bb) {
+        int sq = popLsb(&bb);
+        addMoves(chessBoard, moves, moveCount, sq, allowedTargets(masks, sq, rookAttacks(sq, chessBoard->occupied) & targets));
     }
+    
+    bb = own[QUEEN];
+    while (bb) {
+        int sq = popLsb(&bb);
+        U64 attacks = rookAttacks(sq, chessBoard->occupied) | bishopAttacks(sq, chessBoard->occupied);
+        addMoves(chessBoard, moves, moveCount, sq, allowedTargets(masks, sq, attacks & targets));
+    }
+    
+    if ((genType == GEN_ALL || genType == GEN_QUIETS) && masks->checkerCount == 0) {
+        generateCastlingMoves(chessBoard, moves, moveCount, isWhite);
+    }
+}
+
+// Fully legal moves: checkers and pins are found once, so no move has to be tried on the board
+void generateLegalMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, int genType)
+{
+    MOVEMASKS masks;
+    computeMoveMasks(chessBoard, isWhite, &masks);
+    generateMaskedMoves(chessBoard, moves, moveCount, isWhite, genType, &masks);
+}
+
+// Checks the mover's king against the occupancy the move would leave behind, without playing it
+bool isLegalMove(BOARD *chessBoard, MOVE move)
+{
+    int color = pieceColor(move.movedPiece);
+    int fromSq = COORD_TO_SQUARE(move.from), toSq = COORD_TO_SQUARE(move.to);
+    U64 captured = (move.capturedPiece != EMPTY) ? SQUARE_BIT(toSq) : 0;
+    
+    if (move.isEnPassant) {
+        captured = SQUARE_BIT(color == WHITE ? toSq + 8 : toSq - 8);
+    }
+    
+    U64 occupied = ((chessBoard->occupied & ~SQUARE_BIT(fromSq)) | SQUARE_BIT(toSq)) & ~(captured & ~SQUARE_BIT(toSq));
+    location king = (color == WHITE) ? chessBoard->whiteKing : chessBoard->blackKing;
+    int kingSq = (pieceType(move.movedPiece) == KING) ? toSq : SQUARE(king.x, king.y);
+    
+    // A captured piece no longer attacks anything
+    return (attackersTo(chessBoard, kingSq, color ^ 1, occupied) & ~captured) == 0;
+}
+
+// Whether the move attacks the enemy king, directly or by uncovering one of our sliders
+bool givesCheck(BOARD *chessBoard, MOVE move)
+{
+    int color = pieceColor(move.movedPiece);
+    int fromSq = COORD_TO_SQUARE(move.from), toSq = COORD_TO_SQUARE(move.to);
+    int kingSq = __builtin_ctzll(chessBoard->pieceBB[color ^ 1][KING]);
+    U64 *own = chessBoard->pieceBB[color];
+    U64 occupied = (chessBoard->occupied & ~SQUARE_BIT(fromSq)) | SQUARE_BIT(toSq);
+    
+    if (move.isEnPassant) {
+        occupied &= ~SQUARE_BIT(color == WHITE ? toSq + 8 : toSq - 8);
+    }
+    if (move.isCastling) {
+        // Only the rook can give check, from the square next to the king
+        bool kingside = toSq % 8 == 6;
+        int rookFrom = toSq + (kingside ? 1 : -2), rookTo = toSq + (kingside ? -1 : 1);
+        occupied = (occupied & ~SQUARE_BIT(rookFrom)) | SQUARE_BIT(rookTo);
+        return (rookAttacks(rookTo, occupied) & SQUARE_BIT(kingSq)) != 0;
+    }
+    
+    U64 attacks = 0;
+    switch (pieceType(move.promotionPiece != EMPTY ? move.promotionPiece : move.movedPiece)) {
+        case PAWN: attacks = pawnAttacks[color][toSq]; break;
+        case KNIGHT: attacks = knightAttacks[toSq]; break;
+        case BISHOP: attacks = bishopAttacks(toSq, occupied); break;
+        case ROOK: attacks = rookAttacks(toSq, occupied); break;
+        case QUEEN: attacks = bishopAttacks(toSq, occupied) | rookAttacks(toSq, occupied); break;
+    }
+    if (attacks & SQUARE_BIT(kingSq)) return true;
+    
+    // The moved piece has left its square, so the sliders still on theirs are the ones to look for
+    U64 diagonal = (own[BISHOP] | own[QUEEN]) & ~SQUARE_BIT(fromSq);
+    U64 straight = (own[ROOK] | own[QUEEN]) & ~SQUARE_BIT(fromSq);
+    return (bishopAttacks(kingSq, occupied) & diagonal) || (rookAttacks(kingSq, occupied) & straight);
 }
 
 void generatePromotionMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, bool isWhite, int from, int to)
 {
-    char pawn = isWhite ? 'P' : 'p';
-    char captured = chessBoard->board[to/10][to%10].piece;
+    int color = isWhite ? WHITE : BLACK;
+    int captured = chessBoard->board[to/10][to%10];
     
-    char promotionPieces[] = {'Q', 'R', 'B', 'N'};
+    int promotionTypes[] = {QUEEN, ROOK, BISHOP, KNIGHT};
     for (int i = 0; i < 4; i++) {
         MOVE move;
         move.from = from;
         move.to = to;
-        move.movedPiece = pawn;
+        move.movedPiece = MAKE_PIECE(color, PAWN);
         move.capturedPiece = captured;
-        move.promotionPiece = isWhite ? promotionPieces[i] : tolower(promotionPieces[i]);
+        move.promotionPiece = MAKE_PIECE(color, promotionTypes[i]);
         move.isCastling = false;
         move.isEnPassant = false;
         move.score = 0;
@@ -2528,26 +3169,12 @@ void generatePromotionMoves(BOARD *chessBoard, MOVE moves[], int *moveCount, boo
 
 bool isPinnedPiece(BOARD *chessBoard, int piecePos, bool isWhite)
 {
-    int pieceX = piecePos % 10, pieceY = piecePos / 10;
-    int kingX = isWhite ? chessBoard->whiteKing.x : chessBoard->blackKing.x;
-    int kingY = isWhite ? chessBoard->whiteKing.y : chessBoard->blackKing.y;
-    
-    // Check if piece is on the same line as king
-    bool sameLine = (pieceX == kingX) || (pieceY == kingY) || (abs(pieceX - kingX) == abs(pieceY - kingY));
-    if (!sameLine) return false;
+    int x = piecePos % 10, y = piecePos / 10;
+    if (chessBoard->board[y][x] == EMPTY) return false;
     
-    // Temporarily remove the piece and see if king is in check
-    char originalPiece = chessBoard->board[pieceY][pieceX].piece;
-    chessBoard->board[pieceY][pieceX].piece = ' ';
-    chessBoard->board[pieceY][pieceX].live = false;
-    
-    bool kingInCheck = moveLeavesKingInCheck(chessBoard, isWhite ? 0 : 1);
-    
-    // Restore the piece
-    chessBoard->board[pieceY][pieceX].piece = originalPiece;
-    chessBoard->board[pieceY][pieceX].live = true;
-    
-    return kingInCheck;
+    MOVEMASKS masks;
+    computeMoveMasks(chessBoard, isWhite, &masks);
+    return (masks.pinned & SQUARE_BIT(SQUARE(x, y))) != 0;
 }
 
 MOVE getOpeningMove(BOARD *chessBoard)
@@ -2561,13 +3188,13 @@ MOVE getOpeningMove(BOARD *chessBoard)
     if (chessBoard->moveCount == 0) {
         // First move options
         MOVE moves[] = {
-            {61, 41, 'p', ' ', ' ', false, false, 0}, // e2-e4 
-            {61, 51, 'p', ' ', ' ', false, false, 0}, // e2-e3
-            {51, 31, 'p', ' ', ' ', false, false, 0}, // d2-d4
-            {51, 41, 'p', ' ', ' ', false, false, 0}  // d2-d3
+            {61, 41, BLACK_PAWN, EMPTY, EMPTY, false, false, 0}, // e2-e4 
+            {61, 51, BLACK_PAWN, EMPTY, EMPTY, false, false, 0}, // e2-e3
+            {51, 31, BLACK_PAWN, EMPTY, EMPTY, false, false, 0}, // d2-d4
+            {51, 41, BLACK_PAWN, EMPTY, EMPTY, false, false, 0}  // d2-d3
         };
         
-        MOVE moves_available[200];
+        MOVE moves_available[MAX_MOVES];
         int moveCount;
         generateMoves(chessBoard, moves_available, &moveCount, false);
         
@@ -2583,13 +3210,13 @@ MOVE getOpeningMove(BOARD *chessBoard)
     if (chessBoard->moveCount == 2) {
         // Second move - develop pieces
         MOVE moves[] = {
-            {1, 22, 'n', ' ', ' ', false, false, 0},  // Nb8-c6
-            {6, 25, 'n', ' ', ' ', false, false, 0},  // Ng8-f6
-            {1, 32, 'n', ' ', ' ', false, false, 0},  // Nb8-d7
-            {6, 27, 'n', ' ', ' ', false, false, 0}   // Ng8-h6
+            {1, 22, BLACK_KNIGHT, EMPTY, EMPTY, false, false, 0},  // Nb8-c6
+            {6, 25, BLACK_KNIGHT, EMPTY, EMPTY, false, false, 0},  // Ng8-f6
+            {1, 32, BLACK_KNIGHT, EMPTY, EMPTY, false, false, 0},  // Nb8-d7
+            {6, 27, BLACK_KNIGHT, EMPTY, EMPTY, false, false, 0}   // Ng8-h6
         };
         
-        MOVE moves_available[200];
+        MOVE moves_available[MAX_MOVES];
         int moveCount;
         generateMoves(chessBoard, moves_available, &moveCount, false);
         
@@ -2605,13 +3232,13 @@ MOVE getOpeningMove(BOARD *chessBoard)
     if (chessBoard->moveCount == 4) {
         // Third move - bishops and more development
         MOVE moves[] = {
-            {2, 25, 'b', ' ', ' ', false, false, 0},  // Bc8-f5
-            {5, 24, 'b', ' ', ' ', false, false, 0},  // Bf8-e7
-            {5, 23, 'b', ' ', ' ', false, false, 0},  // Bf8-d6
-            {2, 33, 'b', ' ', ' ', false, false, 0}   // Bc8-d7
+            {2, 25, BLACK_BISHOP, EMPTY, EMPTY, false, false, 0},  // Bc8-f5
+            {5, 24, BLACK_BISHOP, EMPTY, EMPTY, false, false, 0},  // Bf8-e7
+            {5, 23, BLACK_BISHOP, EMPTY, EMPTY, false, false, 0},  // Bf8-d6
+            {2, 33, BLACK_BISHOP, EMPTY, EMPTY, false, false, 0}   // Bc8-d7
         };
         
-        MOVE moves_available[200];
+        MOVE moves_available[MAX_MOVES];
         int moveCount;
         generateMoves(chessBoard, moves_available, &moveCount, false);
         
@@ -2627,12 +3254,12 @@ MOVE getOpeningMove(BOARD *chessBoard)
     if (chessBoard->moveCount == 6) {
         // Fourth move - castling or more development
         MOVE moves[] = {
-            {4, 6, 'k', ' ', ' ', true, false, 0},    // Castling kingside
-            {4, 2, 'k', ' ', ' ', true, false, 0},    // Castling queenside
-            {3, 22, 'q', ' ', ' ', false, false, 0}   // Queen development
+            {4, 6, BLACK_KING, EMPTY, EMPTY, true, false, 0},    // Castling kingside
+            {4, 2, BLACK_KING, EMPTY, EMPTY, true, false, 0},    // Castling queenside
+            {3, 22, BLACK_QUEEN, EMPTY, EMPTY, false, false, 0}   // Queen development
         };
         
-        MOVE moves_available[200];
+        MOVE moves_available[MAX_MOVES];
         int moveCount;
         generateMoves(chessBoard, moves_available, &moveCount, false);
         
@@ -2656,7 +3283,7 @@ void printBoard(BOARD *chessBoard)
         printf("%i|", 8 - i);
         for (int k = 0; k < 8; k++)
         {
-            printf("%c|", chessBoard->board[i][k].piece);
+            printf("%c|", pieceChars[chessBoard->board[i][k]]);
         }
         printf("\n");
     }
@@ -2669,13 +3296,25 @@ static void sanityValidateBoard(BOARD *b, const char *phase)
     // Count white/black pieces and ensure king squares are correct chars.
     int w=0,bk=0;
     for (int y=0;y<8;y++) for (int x=0;x<8;x++) {
-        char p=b->board[y][x].piece;
-        if (p>='A'&&p<='Z') w++;
-        else if (p>='a'&&p<='z') bk++;
-    }
-    char wk = b->board[b->whiteKing.y][b->whiteKing.x].piece;
-    char bkch= b->board[b->blackKing.y][b->blackKing.x].piece;
-    if (wk!='K'||bkch!='k') {
-        printf("[SANITY] %s: king mismatch K=%c k=%c\n", phase, wk, bkch);
+        int p=b->board[y][x];
+        if (p!=EMPTY&&pieceColor(p)==WHITE) w++;
+        else if (p!=EMPTY) bk++;
+    }
+    int wk = b->board[b->whiteKing.y][b->whiteKing.x];
+    int bkch= b->board[b->blackKing.y][b->blackKing.x];
+    if (wk!=WHITE_KING||bkch!=BLACK_KING) {
+        printf("[SANITY] %s: king mismatch K=%c k=%c\n", phase, pieceChars[wk], pieceChars[bkch]);
+    }
+    // The bitboards must describe exactly the same position as the mailbox
+    for (int y=0;y<8;y++) for (int x=0;x<8;x++) {
+        int p=b->board[y][x];
+        U64 bit=SQUARE_BIT(SQUARE(x,y));
+        bool onBoard=(b->occupied&bit)!=0;
+        if (onBoard!=(p!=EMPTY) || (p!=EMPTY&&!(b->pieceBB[pieceColor(p)][pieceType(p)]&bit))) {
+            printf("[SANITY] %s: bitboard mismatch at %c%d (%c)\n", phase, 'a'+x, 8-y, pieceChars[p]);
+        }
+    }
+    if (b->key!=computeKey(b)) {
+        printf("[SANITY] %s: incremental key differs from recomputed key\n", phase);
     }
 }
\ No newline at end of file